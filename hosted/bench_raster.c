@@ -0,0 +1,248 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Built as one unit with the WM so the static drawing helpers are reachable */
+#include "../src/main.c"
+#include "mock_kernel.h"
+#include "bench_util.h"
+
+/*
+ * Rasterizer microbenchmarks: times the drawing primitives on the mock
+ * framebuffer across common resolutions, each with a tight pitch and with
+ * padded (odd) pitch rows.
+ */
+
+#define BENCH_DEFAULT_REPS 50
+#define BENCH_DEFAULT_WARMUP 5
+#define BENCH_PITCH_PAD 17
+
+typedef struct {
+    uint32_t width, height;
+} bench_resolution_t;
+
+typedef struct {
+    const char* name;
+    void (*run)(void);
+    uint64_t (*pixels)(void);
+} bench_case_t;
+
+static const bench_resolution_t g_resolutions[] = {
+    { 800, 600 },
+    { 1920, 1080 },
+    { 2560, 1440 },
+    { 3840, 2160 },
+};
+
+static window_t g_bench_window;
+static window_position_t g_bench_position;
+static volatile uint32_t g_bench_sink;
+static uint32_t* g_bench_source;
+
+/* ------------------------------------------------------------------------- */
+/* Cases                                                                     */
+/* ------------------------------------------------------------------------- */
+
+static uint64_t screen_pixels(void) {
+    return (uint64_t)g_output->width * g_output->height;
+}
+
+static uint64_t small_rect_pixels(void) {
+    return 64 * 64;
+}
+
+static uint64_t frame_pixels(void) {
+    return (uint64_t)g_bench_position.width * g_bench_position.height;
+}
+
+static void run_fill_rect(void) {
+    fill_rect(0, 0, g_output->width, g_output->height, g_bench_sink++);
+}
+
+/* Many small rects spread over the screen, like borders and bar cells */
+static void run_fill_rect_small(void) {
+    uint32_t x = (g_bench_sink * 97) % (g_output->width - 64);
+    uint32_t y = (g_bench_sink * 61) % (g_output->height - 64);
+    fill_rect(x, y, 64, 64, g_bench_sink++);
+}
+
+/* One call per pixel, the worst case for per-call overhead */
+static void run_fill_pixels(void) {
+    uint32_t color = g_bench_sink++;
+    for (uint32_t y = 0; y < g_output->height; y++) {
+        for (uint32_t x = 0; x < g_output->width; x++) {
+            fill_rect(x, y, 1, 1, color);
+        }
+    }
+}
+
+/* Full-screen blit from an ARGB buffer, which converts every pixel */
+static void run_blit(void) {
+    blit_rect(0, 0, g_output->width, g_output->height, g_bench_source, g_output->width);
+    g_bench_sink++;
+}
+
+static void run_clear_screen(void) {
+    clear_screen();
+    g_bench_sink++;
+}
+
+static void run_frame(void) {
+    draw_window_frame(&g_bench_window, &g_bench_position, DEFAULT_BORDER_SIZE,
+                      COLOR_BORDER_NORMAL, 0);
+}
+
+static void run_frame_focused(void) {
+    draw_window_frame(&g_bench_window, &g_bench_position, DEFAULT_BORDER_SIZE,
+                      COLOR_BORDER_NORMAL, 1);
+}
+
+static const bench_case_t g_cases[] = {
+    { "fill_rect",         run_fill_rect,       screen_pixels },
+    { "fill_rect_64",      run_fill_rect_small, small_rect_pixels },
+    { "fill_1x1",          run_fill_pixels,     screen_pixels },
+    { "blit",              run_blit,            screen_pixels },
+    { "clear_screen",      run_clear_screen,    screen_pixels },
+    { "window_frame",      run_frame,           frame_pixels },
+    { "window_frame_focus", run_frame_focused,  frame_pixels },
+};
+
+/* ------------------------------------------------------------------------- */
+/* Driver                                                                    */
+/* ------------------------------------------------------------------------- */
+
+/* Points the WM at a fresh mock framebuffer and a half-screen window with a surface */
+static int bench_setup(uint32_t width, uint32_t height, uint32_t pitch) {
+    struct kernel_api* api = mock_kernel_init(width, height, pitch);
+    if (!api) return -1;
+
+    g_api = api;
+    outputs_init();
+
+    free(g_bench_source);
+    g_bench_source = malloc((size_t)width * height * sizeof(uint32_t));
+    if (!g_bench_source) return -1;
+    for (uint32_t i = 0; i < width * height; i++) g_bench_source[i] = i * 0x010203;
+
+    window_title_release(&g_bench_window);
+    surface_release(g_bench_window.surface);
+    memset(&g_bench_window, 0, sizeof(g_bench_window));
+    string_copy(g_bench_window.title, "benchmark");
+    g_bench_window.handle = 1;
+
+    g_bench_position.x = DEFAULT_GAP_SIZE;
+    g_bench_position.y = g_bar_height + DEFAULT_GAP_SIZE;
+    g_bench_position.width = width / 2;
+    g_bench_position.height = height - g_bench_position.y - DEFAULT_GAP_SIZE;
+    g_bench_position.handle = 1;
+
+    uint32_t frame_h = DEFAULT_BORDER_SIZE * 2 + title_bar_height();
+    window_fit_surface(&g_bench_window, g_bench_position.width - DEFAULT_BORDER_SIZE * 2,
+                       g_bench_position.height - frame_h);
+    return 0;
+}
+
+static void bench_case(const bench_case_t* bc, uint32_t pitch, uint32_t reps, uint32_t warmup,
+                       uint64_t* ns, uint64_t* cycles) {
+    for (uint32_t i = 0; i < warmup; i++) bc->run();
+
+    for (uint32_t i = 0; i < reps; i++) {
+        uint64_t t0 = now_ns();
+        uint64_t c0 = now_cycles();
+        bc->run();
+        cycles[i] = now_cycles() - c0;
+        ns[i] = now_ns() - t0;
+    }
+    qsort(ns, reps, sizeof(*ns), compare_u64);
+    qsort(cycles, reps, sizeof(*cycles), compare_u64);
+
+    double mean = 0, var = 0;
+    for (uint32_t i = 0; i < reps; i++) mean += (double)ns[i];
+    mean /= reps;
+    for (uint32_t i = 0; i < reps; i++) var += ((double)ns[i] - mean) * ((double)ns[i] - mean);
+    double stddev = reps > 1 ? sqrt(var / (reps - 1)) : 0;
+
+    uint64_t median = ns[reps / 2];
+    double pixels = (double)bc->pixels();
+    double ns_per_px = median ? (double)median / pixels : 0;
+    double gbps = median ? pixels * g_output->bytes_pp / (double)median : 0;
+
+    printf("%4ux%-4u %5u  %-18s %5u %10llu %10llu %10llu %9.1f%% %8.3f %7.2f %12llu\n",
+           g_output->width, g_output->height, pitch, bc->name, reps,
+           (unsigned long long)ns[0], (unsigned long long)median,
+           (unsigned long long)ns[reps - 1], mean ? 100.0 * stddev / mean : 0,
+           ns_per_px, gbps, (unsigned long long)cycles[reps / 2]);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-r reps] [-w warmup] [-c case] [-s WIDTHxHEIGHT] [-f format]\n", prog);
+}
+
+int main(int argc, char** argv) {
+    uint32_t reps = BENCH_DEFAULT_REPS, warmup = BENCH_DEFAULT_WARMUP;
+    const char* only_case = NULL;
+    bench_resolution_t only_res = { 0, 0 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:w:c:s:f:")) != -1) {
+        switch (opt) {
+            case 'r': reps = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'w': warmup = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'c': only_case = optarg; break;
+            case 's':
+                if (sscanf(optarg, "%ux%u", &only_res.width, &only_res.height) != 2) {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'f':
+                if (!mock_fb_format(optarg)) {
+                    fprintf(stderr, "unknown format %s\n", optarg);
+                    return 2;
+                }
+                mock_kernel_set_format(mock_fb_format(optarg));
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (reps == 0) reps = 1;
+
+    uint64_t* ns = malloc(reps * sizeof(uint64_t));
+    uint64_t* cycles = malloc(reps * sizeof(uint64_t));
+    if (!ns || !cycles) return 1;
+
+    /* One-time module state the drawing paths rely on */
+    g_api = mock_kernel_init(64, 64, 0);
+    slab_init(&g_surface_slab, "surface", sizeof(surface_t));
+    arena_init(&g_frame_arena, "frame", g_frame_arena_storage, FRAME_ARENA_SIZE);
+    font_init();
+
+    printf("%-9s %5s  %-18s %5s %10s %10s %10s %10s %8s %7s %12s\n",
+           "res", "pitch", "case", "reps", "min_ns", "median_ns", "max_ns", "cv%",
+           "ns/px", "GB/s", "cycles/call");
+
+    uint32_t res_count = sizeof(g_resolutions) / sizeof(g_resolutions[0]);
+    uint32_t case_count = sizeof(g_cases) / sizeof(g_cases[0]);
+    for (uint32_t r = 0; r < res_count; r++) {
+        bench_resolution_t res = only_res.width ? only_res : g_resolutions[r];
+        for (uint32_t pad = 0; pad <= BENCH_PITCH_PAD; pad += BENCH_PITCH_PAD) {
+            if (bench_setup(res.width, res.height, res.width + pad) < 0) {
+                fprintf(stderr, "cannot allocate %ux%u\n", res.width, res.height);
+                return 1;
+            }
+            for (uint32_t c = 0; c < case_count; c++) {
+                if (only_case && strcmp(only_case, g_cases[c].name) != 0) continue;
+                bench_case(&g_cases[c], res.width + pad, reps, warmup, ns, cycles);
+            }
+        }
+        if (only_res.width) break;
+    }
+
+    free(ns);
+    free(cycles);
+    return 0;
+}
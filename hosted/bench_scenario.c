@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Built as one unit with the WM so the redraw state and pixel counter are reachable */
+#include "../src/main.c"
+#include "mock_kernel.h"
+#include "bench_util.h"
+
+/*
+ * Scenario replay: presses scripted hotkey sequences through the callbacks the
+ * module registered and measures each step (wall time, cycles and framebuffer
+ * pixels written). Every repetition starts from an empty desktop; per-step
+ * timings are medians over the repetitions.
+ */
+
+#define BENCH_DEFAULT_REPS 20
+#define BENCH_MAX_STEPS 128
+#define HOTKEY_MODIFIERS 1
+
+typedef struct {
+    char key;
+    const char* name;
+    int scancode;
+} bench_hotkey_t;
+
+typedef struct {
+    const char* name;
+    const char* description;
+    const char* script;      /* one hotkey letter per step, spaces ignored */
+} bench_scenario_t;
+
+typedef struct {
+    const bench_hotkey_t* hotkey;
+    uint32_t windows;        /* visible windows after the step */
+    layout_type_t layout;
+    uint64_t* ns;            /* one sample per repetition */
+    uint64_t* cycles;
+    uint64_t pixels;
+} bench_step_t;
+
+static const bench_hotkey_t g_hotkeys[] = {
+    { 'n', "new",    0x11 },
+    { 'c', "close",  0x10 },
+    { 'l', "layout", 0x26 },
+    { 'f', "focus",  0x20 },
+    { 'h', "hide",   0x32 },
+    { 's', "show",   0x13 },
+};
+
+#define HOTKEY_COUNT (sizeof(g_hotkeys) / sizeof(g_hotkeys[0]))
+
+static const bench_scenario_t g_scenarios[] = {
+    { "open-cycle-close", "open 6, cycle all layouts, focus around, close all",
+      "nnnnnn lllll ffffff cccccc" },
+    { "layout-sweep", "cycle all layouts at 1 to 6 windows, then close all",
+      "nlllll nlllll nlllll nlllll nlllll nlllll cccccc" },
+    { "focus-churn", "focus around 3 windows four times",
+      "nnn ffffffffffff ccc" },
+    { "scratchpad", "open 4, hide and show each in turn",
+      "nnnn hshshshs cccc" },
+    { "open-close", "open and close one window repeatedly",
+      "ncncncncnc" },
+};
+
+#define SCENARIO_COUNT (sizeof(g_scenarios) / sizeof(g_scenarios[0]))
+
+static bench_step_t g_steps[BENCH_MAX_STEPS];
+
+static const bench_hotkey_t* find_hotkey(char key) {
+    for (uint32_t i = 0; i < HOTKEY_COUNT; i++) {
+        if (g_hotkeys[i].key == key) return &g_hotkeys[i];
+    }
+    return NULL;
+}
+
+static uint32_t visible_windows(void) {
+    const workspace_t* ws = active_workspace();
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < ws->window_count; i++) {
+        if (!ws->windows[i].is_hidden) count++;
+    }
+    return count;
+}
+
+/* Closes every window and repaints the empty desktop so each repetition starts alike */
+static void bench_reset(void) {
+    begin_batch();
+    for (uint32_t w = 0; w < WORKSPACE_COUNT; w++) {
+        workspace_t* ws = &g_workspaces[w];
+        while (ws->window_count > 0) close_window(ws, ws->window_count - 1);
+        ws->layout = DEFAULT_LAYOUTS[LAYOUT_GRID];
+    }
+    g_active_output = 0;
+    for (uint32_t o = 0; o < g_output_count; o++) {
+        output_t* out = &g_outputs[o];
+        out->workspace = out->first_workspace;
+        out->needs_full_redraw = 1;
+        request_redraw(out);
+    }
+    end_batch();
+}
+
+/* Parses the script into g_steps; returns the step count or -1 */
+static int load_script(const char* script, uint32_t reps) {
+    uint32_t count = 0;
+    for (const char* p = script; *p; p++) {
+        if (*p == ' ') continue;
+        const bench_hotkey_t* hk = find_hotkey(*p);
+        if (!hk || count == BENCH_MAX_STEPS) return -1;
+
+        bench_step_t* step = &g_steps[count++];
+        step->hotkey = hk;
+        free(step->ns);
+        free(step->cycles);
+        step->ns = calloc(reps, sizeof(uint64_t));
+        step->cycles = calloc(reps, sizeof(uint64_t));
+        if (!step->ns || !step->cycles) return -1;
+    }
+    return (int)count;
+}
+
+static int run_scenario(uint32_t step_count, uint32_t reps) {
+    for (uint32_t r = 0; r < reps; r++) {
+        bench_reset();
+        for (uint32_t i = 0; i < step_count; i++) {
+            bench_step_t* step = &g_steps[i];
+            uint64_t pixels = g_pixels_written;
+            uint64_t t0 = now_ns();
+            uint64_t c0 = now_cycles();
+            int found = mock_press_hotkey(step->hotkey->scancode, HOTKEY_MODIFIERS);
+            step->cycles[r] = now_cycles() - c0;
+            step->ns[r] = now_ns() - t0;
+            if (found < 0) return -1;
+
+            step->pixels = g_pixels_written - pixels;
+            step->windows = visible_windows();
+            step->layout = active_workspace()->layout.type;
+        }
+    }
+
+    for (uint32_t i = 0; i < step_count; i++) {
+        qsort(g_steps[i].ns, reps, sizeof(uint64_t), compare_u64);
+        qsort(g_steps[i].cycles, reps, sizeof(uint64_t), compare_u64);
+    }
+    return 0;
+}
+
+static void print_table(const char* name, uint32_t step_count, uint32_t reps) {
+    const output_t* out = &g_outputs[0];
+    double screen = (double)out->width * out->height;
+    uint64_t total_ns = 0, total_cycles = 0, total_pixels = 0;
+
+    printf("\n%s (%ux%u, %u reps)\n", name, out->width, out->height, reps);
+    printf("%4s  %-7s %3s  %-10s %10s %10s %12s %10s %8s\n",
+           "step", "key", "win", "layout", "median_ns", "max_ns", "cycles", "pixels", "screen");
+    for (uint32_t i = 0; i < step_count; i++) {
+        const bench_step_t* step = &g_steps[i];
+        uint64_t ns = step->ns[reps / 2];
+        uint64_t cycles = step->cycles[reps / 2];
+        printf("%4u  %-7s %3u  %-10s %10llu %10llu %12llu %10llu %7.1f%%\n",
+               i + 1, step->hotkey->name, step->windows, LAYOUT_NAMES[step->layout],
+               (unsigned long long)ns, (unsigned long long)step->ns[reps - 1],
+               (unsigned long long)cycles, (unsigned long long)step->pixels,
+               100.0 * (double)step->pixels / screen);
+        total_ns += ns;
+        total_cycles += cycles;
+        total_pixels += step->pixels;
+    }
+    printf("%4s  %-7s %3s  %-10s %10llu %10s %12llu %10llu\n", "", "total", "", "",
+           (unsigned long long)total_ns, "", (unsigned long long)total_cycles,
+           (unsigned long long)total_pixels);
+}
+
+/* One JSON object per scenario: per-step medians plus totals per hotkey */
+static void print_json(FILE* out, const char* name, uint32_t step_count, uint32_t reps, int first) {
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"steps\": [", first ? "" : ",", name);
+    for (uint32_t i = 0; i < step_count; i++) {
+        const bench_step_t* step = &g_steps[i];
+        fprintf(out, "%s\n      {\"key\": \"%s\", \"windows\": %u, \"layout\": \"%s\", "
+                "\"ns\": %llu, \"cycles\": %llu, \"pixels\": %llu}",
+                i ? "," : "", step->hotkey->name, step->windows, LAYOUT_NAMES[step->layout],
+                (unsigned long long)step->ns[reps / 2], (unsigned long long)step->cycles[reps / 2],
+                (unsigned long long)step->pixels);
+    }
+    fprintf(out, "\n    ], \"by_key\": {");
+
+    int first_key = 1;
+    for (uint32_t k = 0; k < HOTKEY_COUNT; k++) {
+        uint64_t n = 0, ns = 0, cycles = 0, pixels = 0;
+        for (uint32_t i = 0; i < step_count; i++) {
+            if (g_steps[i].hotkey != &g_hotkeys[k]) continue;
+            n++;
+            ns += g_steps[i].ns[reps / 2];
+            cycles += g_steps[i].cycles[reps / 2];
+            pixels += g_steps[i].pixels;
+        }
+        if (n == 0) continue;
+        fprintf(out, "%s\"%s\": {\"count\": %llu, \"ns\": %llu, \"cycles\": %llu, \"pixels\": %llu}",
+                first_key ? "" : ", ", g_hotkeys[k].name, (unsigned long long)n,
+                (unsigned long long)ns, (unsigned long long)cycles, (unsigned long long)pixels);
+        first_key = 0;
+    }
+    fprintf(out, "}}");
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-w width] [-h height] [-p pitch_pixels] [-r reps] [-s scenario] "
+            "[-x script] [-j summary.json|-] [-l]\n"
+            "script letters:", prog);
+    for (uint32_t i = 0; i < HOTKEY_COUNT; i++) {
+        fprintf(stderr, " %c=%s", g_hotkeys[i].key, g_hotkeys[i].name);
+    }
+    fputc('\n', stderr);
+}
+
+int main(int argc, char** argv) {
+    uint32_t width = 1920, height = 1080, pitch = 0, reps = BENCH_DEFAULT_REPS;
+    const char* only = NULL;
+    const char* json_path = NULL;
+    bench_scenario_t custom = { "custom", "script from the command line", NULL };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:h:p:r:s:x:j:l")) != -1) {
+        switch (opt) {
+            case 'w': width = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'h': height = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'p': pitch = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'r': reps = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 's': only = optarg; break;
+            case 'x': custom.script = optarg; break;
+            case 'j': json_path = optarg; break;
+            case 'l':
+                for (uint32_t i = 0; i < SCENARIO_COUNT; i++) {
+                    printf("%-18s %s\n", g_scenarios[i].name, g_scenarios[i].description);
+                }
+                return 0;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (reps == 0) reps = 1;
+
+    struct kernel_api* api = mock_kernel_init(width, height, pitch);
+    if (!api) {
+        fprintf(stderr, "bad framebuffer size %ux%u pitch %u\n", width, height, pitch);
+        return 2;
+    }
+    nrio_module_start(api);
+
+    FILE* json = NULL;
+    if (json_path) {
+        json = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "w");
+        if (!json) {
+            perror(json_path);
+            return 1;
+        }
+        fprintf(json, "{\"width\": %u, \"height\": %u, \"pitch\": %u, \"reps\": %u, \"scenarios\": [",
+                g_outputs[0].width, g_outputs[0].height, g_outputs[0].pitch / g_outputs[0].bytes_pp, reps);
+    }
+
+    const bench_scenario_t* list = custom.script ? &custom : g_scenarios;
+    uint32_t list_count = custom.script ? 1 : SCENARIO_COUNT;
+    int status = 0, first = 1;
+    for (uint32_t s = 0; s < list_count; s++) {
+        const bench_scenario_t* sc = &list[s];
+        if (only && strcmp(only, sc->name) != 0) continue;
+
+        int steps = load_script(sc->script, reps);
+        if (steps < 0 || run_scenario((uint32_t)steps, reps) < 0) {
+            fprintf(stderr, "%s: bad script \"%s\"\n", sc->name, sc->script);
+            status = 1;
+            continue;
+        }
+        if (json != stdout) print_table(sc->name, (uint32_t)steps, reps);
+        if (json) print_json(json, sc->name, (uint32_t)steps, reps, first);
+        first = 0;
+    }
+
+    if (json) {
+        fprintf(json, "\n]}\n");
+        if (json != stdout) fclose(json);
+    }
+    return status;
+}
@@ -0,0 +1,513 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Built as one unit with the WM so the reference render can reach the redraw state */
+#include "../src/main.c"
+#include "mock_kernel.h"
+
+/*
+ * Differential fuzzer: applies random hotkeys, control commands, surface
+ * writes and damage commits, and after every step compares the incrementally maintained
+ * framebuffer with a from-scratch repaint of the same WM state. The first
+ * divergent pixel is reported with the step sequence that led to it. Each
+ * case runs in a forked child on a random resolution and pitch, and now and
+ * then switches to another mode mid-sequence. With several outputs every one
+ * is compared, and hotkeys must leave all but the active output untouched.
+ */
+
+#define FUZZ_DEFAULT_CASES 200
+#define FUZZ_DEFAULT_STEPS 60
+#define FUZZ_MAX_STEPS 1024
+#define FUZZ_STEP_MAX 160
+#define FUZZ_DAMAGE_RECTS 4
+#define HOTKEY_MODIFIERS 1
+
+static const struct {
+    const char* name;
+    int scancode;
+} HOTKEYS[] = {
+    { "key new", 0x11 },
+    { "key close", 0x10 },
+    { "key layout", 0x26 },
+    { "key focus", 0x20 },
+    { "key hide", 0x32 },
+    { "key show", 0x13 },
+    { "key output", 0x18 },     /* only picked with several outputs */
+};
+
+#define HOTKEY_COUNT (sizeof(HOTKEYS) / sizeof(HOTKEYS[0]))
+
+static const struct {
+    uint32_t width, height;
+} MODES[] = {
+    { 320, 200 },
+    { 640, 480 },
+    { 800, 600 },
+    { 1024, 768 },
+    { 1280, 720 },
+    { 1920, 1080 },
+};
+
+#define MODE_COUNT (sizeof(MODES) / sizeof(MODES[0]))
+
+static uint64_t g_rng;
+static char g_steps[FUZZ_MAX_STEPS][FUZZ_STEP_MAX];
+static uint32_t g_fuzz_outputs = 1;
+static uint8_t* g_reference[MOCK_MAX_OUTPUTS];
+static uint8_t* g_before[MOCK_MAX_OUTPUTS];   /* outputs a hotkey must not touch */
+
+static uint64_t rng_next(void) {
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 7;
+    g_rng ^= g_rng << 17;
+    return g_rng;
+}
+
+static uint32_t rng_below(uint32_t n) {
+    return (uint32_t)(rng_next() % n);
+}
+
+/* A handle that exists most of the time, occasionally a stale or unknown one */
+static uint32_t random_handle(void) {
+    return 1 + rng_below(g_next_handle + 1);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Steps                                                                     */
+/* ------------------------------------------------------------------------- */
+
+static void random_command(char* out, size_t size) {
+    switch (rng_below(g_fuzz_outputs > 1 ? 13 : 12)) {
+        case 0: snprintf(out, size, "new w%u", rng_below(100)); break;
+        case 1: snprintf(out, size, "close %u", random_handle()); break;
+        case 2: snprintf(out, size, "focus %s", rng_below(2) ? "prev" : "next"); break;
+        case 3: snprintf(out, size, "focus %u", random_handle()); break;
+        case 4: snprintf(out, size, "layout %s", rng_below(4) ? LAYOUT_NAMES[rng_below(LAYOUT_COUNT)] : "next"); break;
+        case 5: snprintf(out, size, "workspace %u", 1 + rng_below(WORKSPACE_COUNT)); break;
+        case 6: snprintf(out, size, "ratio %u", rng_below(101)); break;
+        case 7: snprintf(out, size, "hide %u", random_handle()); break;
+        case 8: snprintf(out, size, "show"); break;
+        case 9: snprintf(out, size, "title %u t%" PRIu64, random_handle(), rng_next() % 100000); break;
+        case 10: snprintf(out, size, "titles %s", rng_below(2) ? "on" : "off"); break;
+        case 12: snprintf(out, size, "output %u", 1 + rng_below(g_fuzz_outputs)); break;
+        default: snprintf(out, size, "hide"); break;
+    }
+}
+
+/* Random mode pitch: tight half of the time, else padded by up to 63 pixels */
+static uint32_t random_pitch(uint32_t width) {
+    return width + (rng_below(2) ? rng_below(64) : 0);
+}
+
+/* Picks the next step, writing a replayable description into `desc` */
+static void random_step(char* desc) {
+    if (rng_below(32) == 0) {
+        uint32_t m = rng_below(MODE_COUNT);
+        int len = snprintf(desc, FUZZ_STEP_MAX, "mode %u %u %u", MODES[m].width, MODES[m].height,
+                           random_pitch(MODES[m].width));
+        if (g_fuzz_outputs > 1) snprintf(desc + len, FUZZ_STEP_MAX - len, " %u", rng_below(g_fuzz_outputs));
+        return;
+    }
+
+    uint32_t kind = rng_below(10);
+    if (kind < 4) {
+        uint32_t hotkeys = g_fuzz_outputs > 1 ? HOTKEY_COUNT : HOTKEY_COUNT - 1;
+        snprintf(desc, FUZZ_STEP_MAX, "%s", HOTKEYS[rng_below(hotkeys)].name);
+    } else if (kind < 7) {
+        strcpy(desc, "cmd ");
+        random_command(desc + 4, FUZZ_STEP_MAX - 4);
+    } else if (kind < 8) {
+        /* Two commands in one write: a single transaction and redraw */
+        char a[64], b[64];
+        random_command(a, sizeof(a));
+        random_command(b, sizeof(b));
+        snprintf(desc, FUZZ_STEP_MAX, "batch %s|%s", a, b);
+    } else if (kind < 9) {
+        snprintf(desc, FUZZ_STEP_MAX, "surface %u %u %u %08x", random_handle(),
+                 rng_below(1 << 20), 1 + rng_below(4096), (uint32_t)rng_next());
+    } else {
+        /* Rects that often overlap, painted and then committed in one ioctl */
+        int len = snprintf(desc, FUZZ_STEP_MAX, "damage %u %08x", random_handle(), (uint32_t)rng_next());
+        for (uint32_t i = 1 + rng_below(FUZZ_DAMAGE_RECTS); i > 0; i--) {
+            len += snprintf(desc + len, FUZZ_STEP_MAX - len, " %u,%u,%u,%u", rng_below(512), rng_below(512),
+                            1 + rng_below(256), 1 + rng_below(256));
+        }
+    }
+}
+
+static int write_control(const char* text) {
+    size_t len = strlen(text);
+    char buf[FUZZ_STEP_MAX + 1];
+    memcpy(buf, text, len);
+    buf[len] = '\n';
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == '|') buf[i] = '\n';
+    }
+    return mock_dev_write(NRIO_CONTROL_DEVICE, buf, len + 1) < 0 ? -1 : 0;
+}
+
+/* Selects a window's surface; returns -1 if it has none to draw into */
+static int select_surface(uint32_t handle, nrio_surface_info_t* info) {
+    if (mock_dev_ioctl(NRIO_SURFACE_DEVICE, NRIO_IOC_SELECT_WINDOW, &handle) < 0) return -1;
+    if (mock_dev_ioctl(NRIO_SURFACE_DEVICE, NRIO_IOC_SURFACE_INFO, info) < 0) return -1;
+    return info->width && info->height ? 0 : -1;
+}
+
+/* Writes `count` pixels at a pixel offset of the selected surface */
+static void write_pixels(uint32_t offset, uint32_t count, uint32_t color) {
+    uint32_t* pixels = malloc(count * sizeof(uint32_t));
+    if (!pixels) return;
+    for (uint32_t i = 0; i < count; i++) pixels[i] = color + i;
+    mock_dev_seek(NRIO_SURFACE_DEVICE, (vfs_off_t)offset * sizeof(uint32_t), VFS_SEEK_SET);
+    mock_dev_write(NRIO_SURFACE_DEVICE, pixels, count * sizeof(uint32_t));
+    free(pixels);
+}
+
+/*
+ * Commits the selected surface's damage with extra rects. Writes alone must
+ * not present, the commit must present exactly once, and the window's damage
+ * list must stay disjoint so no pixel is composited twice.
+ */
+static int commit_damage(uint32_t handle, const nrio_rect_t* rects, uint32_t count, uint64_t presents) {
+    uint32_t ws_index, win_index;
+    if (g_latency[NRIO_LATENCY_PRESENT].count != presents) {
+        fprintf(stderr, "surface writes presented before the commit\n");
+        return -1;
+    }
+
+    nrio_damage_t damage = { count, 0, rects };
+    mock_dev_ioctl(NRIO_SURFACE_DEVICE, NRIO_IOC_DAMAGE, &damage);
+    if (find_window(handle, &ws_index, &win_index)) {
+        const window_t* win = &g_workspaces[ws_index].windows[win_index];
+        for (uint32_t i = 0; i < win->damage_count; i++) {
+            for (uint32_t j = i + 1; j < win->damage_count; j++) {
+                if (!rect_overlaps(&win->damage[i], &win->damage[j])) continue;
+                fprintf(stderr, "damage rects %u and %u of window %u overlap\n", i, j, handle);
+                return -1;
+            }
+        }
+    }
+
+    damage.count = 0;
+    damage.flags = NRIO_DAMAGE_COMMIT;
+    mock_dev_ioctl(NRIO_SURFACE_DEVICE, NRIO_IOC_DAMAGE, &damage);
+    if (g_latency[NRIO_LATENCY_PRESENT].count != presents + 1) {
+        fprintf(stderr, "commit presented %" PRIu64 " times\n", g_latency[NRIO_LATENCY_PRESENT].count - presents);
+        return -1;
+    }
+    return 0;
+}
+
+/* Fills `count` pixels of a window's surface at a pixel offset and commits, like a client would */
+static int write_surface(uint32_t handle, uint32_t offset, uint32_t count, uint32_t color) {
+    nrio_surface_info_t info;
+    if (select_surface(handle, &info) < 0) return 0;
+
+    uint64_t presents = g_latency[NRIO_LATENCY_PRESENT].count;
+    uint32_t size = info.width * info.height;
+    offset %= size;
+    if (count > size - offset) count = size - offset;
+    write_pixels(offset, count, color);
+    return commit_damage(handle, NULL, 0, presents);
+}
+
+/* Paints each "x,y,w,h" rect row by row, then damages all of them and commits */
+static int damage_surface(uint32_t handle, uint32_t color, const char* list) {
+    nrio_surface_info_t info;
+    nrio_rect_t rects[FUZZ_DAMAGE_RECTS];
+    uint32_t count = 0;
+    int used;
+
+    if (select_surface(handle, &info) < 0) return 0;
+    uint64_t presents = g_latency[NRIO_LATENCY_PRESENT].count;
+    while (count < FUZZ_DAMAGE_RECTS && sscanf(list, " %u,%u,%u,%u%n", &rects[count].x, &rects[count].y,
+                                               &rects[count].width, &rects[count].height, &used) == 4) {
+        const nrio_rect_t* r = &rects[count++];
+        list += used;
+        if (r->x >= info.width) continue;
+        uint32_t width = r->width < info.width - r->x ? r->width : info.width - r->x;
+        for (uint32_t y = r->y; y < r->y + r->height && y < info.height; y++) {
+            write_pixels(y * info.width + r->x, width, color + y);
+        }
+    }
+    return commit_damage(handle, rects, count, presents);
+}
+
+/* (Re)allocates an output's reference and hotkey buffers to the mock's mode */
+static int alloc_buffers(uint32_t output) {
+    mock_select_output(output);
+    size_t size = (size_t)mock_fb_pitch() * mock_fb_height();
+    free(g_reference[output]);
+    free(g_before[output]);
+    g_reference[output] = calloc(size, 1);
+    g_before[output] = calloc(size, 1);
+    mock_select_output(0);
+    return g_reference[output] && g_before[output] ? 0 : -1;
+}
+
+/*
+ * Switches one output of the mock to a new mode and resizes its buffers to
+ * match. A mode change must repaint exactly that output, exactly once.
+ */
+static int change_mode(uint32_t output, uint32_t width, uint32_t height, uint32_t pitch) {
+    uint32_t redraws = g_latency[NRIO_LATENCY_REDRAW].count;
+    if (mock_select_output(output) < 0) return -1;
+    int err = mock_kernel_set_mode(width, height, pitch);
+    mock_select_output(0);
+    if (err < 0 || alloc_buffers(output) < 0) return -1;
+
+    redraws = g_latency[NRIO_LATENCY_REDRAW].count - redraws;
+    if (redraws != 1) {
+        fprintf(stderr, "mode %ux%u: %u redraws instead of one\n", width, height, redraws);
+        return -1;
+    }
+    return 0;
+}
+
+/* Hotkeys act on the active output, so every other one must keep its pixels */
+static int press_hotkey(const char* desc) {
+    uint32_t active = g_active_output;
+    for (uint32_t o = 0; o < g_output_count; o++) {
+        const output_t* out = &g_outputs[o];
+        memcpy(g_before[o], out->framebuffer, (size_t)out->pitch * out->height);
+    }
+
+    for (uint32_t i = 0; i < HOTKEY_COUNT; i++) {
+        if (strcmp(desc, HOTKEYS[i].name) == 0) mock_press_hotkey(HOTKEYS[i].scancode, HOTKEY_MODIFIERS);
+    }
+
+    for (uint32_t o = 0; o < g_output_count; o++) {
+        const output_t* out = &g_outputs[o];
+        if (o == active) continue;
+        if (memcmp(g_before[o], out->framebuffer, (size_t)out->pitch * out->height) != 0) {
+            fprintf(stderr, "%s on output %u repainted output %u\n", desc, active + 1, o + 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Returns -1 if the step broke an invariant other than the framebuffer contents */
+static int apply_step(const char* desc) {
+    if (strncmp(desc, "key ", 4) == 0) {
+        return press_hotkey(desc);
+    } else if (strncmp(desc, "cmd ", 4) == 0) {
+        write_control(desc + 4);
+    } else if (strncmp(desc, "batch ", 6) == 0) {
+        write_control(desc + 6);
+    } else if (strncmp(desc, "mode ", 5) == 0) {
+        uint32_t width, height, pitch, output = 0;
+        if (sscanf(desc, "mode %u %u %u %u", &width, &height, &pitch, &output) < 3) return -1;
+        return change_mode(output, width, height, pitch);
+    } else if (strncmp(desc, "damage ", 7) == 0) {
+        uint32_t handle, color;
+        int used;
+        if (sscanf(desc, "damage %u %x%n", &handle, &color, &used) < 2) return -1;
+        return damage_surface(handle, color, desc + used);
+    } else {
+        uint32_t handle, offset, count, color;
+        if (sscanf(desc, "surface %u %u %u %x", &handle, &offset, &count, &color) == 4) {
+            return write_surface(handle, offset, count, color);
+        }
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Reference render                                                          */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Repaints the current state of every output from scratch into its reference
+ * buffer. Everything the redraw updates besides pixels is saved and restored,
+ * so the incremental renderer continues as if the reference render never
+ * happened.
+ */
+static void reference_render(void) {
+    output_t saved;
+    uint32_t damage_count[WORKSPACE_COUNT][MAX_WINDOWS_PER_WORKSPACE];
+    uint8_t title_dirty[WORKSPACE_COUNT][MAX_WINDOWS_PER_WORKSPACE];
+
+    for (uint32_t w = 0; w < WORKSPACE_COUNT; w++) {
+        for (uint32_t i = 0; i < MAX_WINDOWS_PER_WORKSPACE; i++) {
+            damage_count[w][i] = g_workspaces[w].windows[i].damage_count;
+            title_dirty[w][i] = g_workspaces[w].windows[i].title_dirty;
+        }
+    }
+    uint64_t event_head = g_event_head;
+    output_t* current = g_output;
+
+    for (uint32_t o = 0; o < g_output_count; o++) {
+        output_t* out = &g_outputs[o];
+        saved = *out;
+        out->framebuffer = g_reference[o];
+        out->needs_full_redraw = 1;
+        redraw_incremental(out);
+        *out = saved;
+    }
+
+    for (uint32_t w = 0; w < WORKSPACE_COUNT; w++) {
+        for (uint32_t i = 0; i < MAX_WINDOWS_PER_WORKSPACE; i++) {
+            g_workspaces[w].windows[i].damage_count = damage_count[w][i];
+            g_workspaces[w].windows[i].title_dirty = title_dirty[w][i];
+        }
+    }
+    g_output = current;
+    g_event_head = event_head;
+}
+
+/* Native value of one pixel in either framebuffer */
+static uint32_t pixel_value(const output_t* out, const uint8_t* fb, uint32_t x, uint32_t y) {
+    uint32_t value = 0;
+    memcpy(&value, &fb[y * out->pitch + x * out->bytes_pp], out->bytes_pp);
+    return value;
+}
+
+/* Returns 1 and the first differing pixel if an output disagrees with its reference */
+static int find_divergence(const output_t* out, const uint8_t* reference, uint32_t* x_out, uint32_t* y_out) {
+    for (uint32_t y = 0; y < out->height; y++) {
+        const uint8_t* a = &out->framebuffer[y * out->pitch];
+        const uint8_t* b = &reference[y * out->pitch];
+        for (uint32_t x = 0; x < out->width; x++) {
+            if (memcmp(&a[x * out->bytes_pp], &b[x * out->bytes_pp], out->bytes_pp) != 0) {
+                *x_out = x;
+                *y_out = y;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Overwrites the mock framebuffer, so only use it once the case is over */
+static void save_reference_ppm(uint32_t output, const char* path) {
+    mock_select_output(output);
+    memcpy(mock_framebuffer(), g_reference[output], (size_t)mock_fb_pitch() * mock_fb_height());
+    mock_framebuffer_save_ppm(path);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Driver                                                                    */
+/* ------------------------------------------------------------------------- */
+
+static int run_case(uint64_t seed, uint32_t steps, const char* format, const char* out_dir,
+                    int verbose) {
+    g_rng = seed ? seed : 1;
+    uint32_t m = rng_below(MODE_COUNT);
+    uint32_t width = MODES[m].width, height = MODES[m].height;
+    uint32_t pitch = random_pitch(width);
+
+    mock_kernel_set_format(format ? mock_fb_format(format) : NULL);
+    struct kernel_api* api = mock_kernel_init(width, height, pitch);
+    for (uint32_t o = 1; api && o < g_fuzz_outputs; o++) {
+        m = rng_below(MODE_COUNT);
+        if (mock_kernel_add_output(MODES[m].width, MODES[m].height, random_pitch(MODES[m].width)) < 0) api = NULL;
+    }
+    for (uint32_t o = 0; api && o < g_fuzz_outputs; o++) {
+        if (alloc_buffers(o) < 0) api = NULL;
+    }
+    if (!api) {
+        fprintf(stderr, "seed %" PRIu64 ": cannot allocate %ux%u\n", seed, width, height);
+        return 1;
+    }
+    nrio_module_start(api);
+
+    for (uint32_t step = 0; step < steps; step++) {
+        random_step(g_steps[step]);
+        if (verbose) fprintf(stderr, "  %3u %s\n", step + 1, g_steps[step]);
+        if (apply_step(g_steps[step]) < 0) {
+            fprintf(stderr, "seed %" PRIu64 ": step %u failed\n", seed, step + 1);
+            for (uint32_t i = 0; i <= step; i++) fprintf(stderr, "  %3u %s\n", i + 1, g_steps[i]);
+            return 1;
+        }
+
+        uint32_t o, x, y;
+        reference_render();
+        for (o = 0; o < g_output_count; o++) {
+            if (find_divergence(&g_outputs[o], g_reference[o], &x, &y)) break;
+        }
+        if (o == g_output_count) continue;
+
+        const output_t* out = &g_outputs[o];
+        uint32_t actual = pixel_value(out, out->framebuffer, x, y);
+        uint32_t expected = pixel_value(out, g_reference[o], x, y);
+        fprintf(stderr, "seed %" PRIu64 " (output %u, %ux%u pitch %u): step %u diverges at (%u, %u): "
+                "incremental %06x, reference %06x\n",
+                seed, o + 1, out->width, out->height, out->pitch / out->bytes_pp, step + 1, x, y,
+                actual, expected);
+        for (uint32_t i = 0; i <= step; i++) fprintf(stderr, "  %3u %s\n", i + 1, g_steps[i]);
+
+        if (out_dir) {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/fuzz-%" PRIu64 "-incremental.ppm", out_dir, seed);
+            mock_select_output(o);
+            mock_framebuffer_save_ppm(path);
+            snprintf(path, sizeof(path), "%s/fuzz-%" PRIu64 "-reference.ppm", out_dir, seed);
+            save_reference_ppm(o, path);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-n cases] [-k steps] [-s seed] [-f format] [-O outputs] [-o out_dir] [-v]\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    uint32_t cases = FUZZ_DEFAULT_CASES, steps = FUZZ_DEFAULT_STEPS;
+    uint64_t seed = 1;
+    const char* out_dir = NULL;
+    const char* format = NULL;
+    int verbose = 0, opt;
+
+    while ((opt = getopt(argc, argv, "n:k:s:f:O:o:v")) != -1) {
+        switch (opt) {
+            case 'n': cases = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'k': steps = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            case 'f': format = optarg; break;
+            case 'O': g_fuzz_outputs = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'o': out_dir = optarg; break;
+            case 'v': verbose = 1; break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (steps > FUZZ_MAX_STEPS) steps = FUZZ_MAX_STEPS;
+    if (g_fuzz_outputs == 0 || g_fuzz_outputs > MOCK_MAX_OUTPUTS) {
+        fprintf(stderr, "outputs must be 1..%u\n", MOCK_MAX_OUTPUTS);
+        return 2;
+    }
+    if (format && !mock_fb_format(format)) {
+        fprintf(stderr, "unknown format %s\n", format);
+        return 2;
+    }
+
+    uint32_t failed = 0;
+    for (uint32_t c = 0; c < cases; c++) {
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 2;
+        }
+        if (pid == 0) _exit(run_case(seed + c, steps, format, out_dir, verbose));
+
+        int status;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            if (!WIFEXITED(status)) fprintf(stderr, "seed %" PRIu64 ": crashed\n", seed + c);
+            failed++;
+        }
+    }
+
+    printf("%u/%u cases matched the reference (seeds %" PRIu64 "..%" PRIu64 ", %u steps)\n",
+           cases - failed, cases, seed, seed + cases - 1, steps);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mock_kernel.h"
+
+typedef struct {
+    char name[MAX_FILENAME];
+    const uint8_t* data;
+    size_t size;
+} mock_file_t;
+
+typedef struct {
+    const mock_file_t* file;
+    size_t pos;
+    int open;
+} mock_fd_t;
+
+/* First descriptor handed out by the mock VFS */
+#define MOCK_FD_BASE 3
+
+typedef struct {
+    const char* name;
+    struct fb_format format;
+} mock_format_t;
+
+static const mock_format_t MOCK_FORMATS[] = {
+    { "xrgb8888", { 32, 0xFF0000, 0x00FF00, 0x0000FF } },
+    { "xbgr8888", { 32, 0x0000FF, 0x00FF00, 0xFF0000 } },
+    { "rgb888",   { 24, 0xFF0000, 0x00FF00, 0x0000FF } },
+    { "bgr888",   { 24, 0x0000FF, 0x00FF00, 0xFF0000 } },
+    { "rgb565",   { 16, 0xF800,   0x07E0,   0x001F } },
+    { "bgr565",   { 16, 0x001F,   0x07E0,   0xF800 } },
+    { "rgb555",   { 16, 0x7C00,   0x03E0,   0x001F } },
+};
+
+typedef struct {
+    uint8_t* fb;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;                          /* pixels per row */
+    struct fb_format format;
+} mock_output_t;
+
+static struct kernel_api g_mock_api;
+static mock_output_t g_mock_outputs[MOCK_MAX_OUTPUTS];
+static uint32_t g_mock_output_count = 0;
+static uint32_t g_mock_selected = 0;         /* output the accessors and set_mode use */
+static struct fb_format g_mock_format = { 32, 0xFF0000, 0x00FF00, 0x0000FF };
+static int g_mock_has_format = 0;
+
+static struct {
+    void (*callback)(void*);
+    void* data;
+} g_mock_mode_handlers[MOCK_MAX_MODE_HANDLERS];
+static uint32_t g_mock_mode_handler_count = 0;
+
+static mock_hotkey_t g_mock_hotkeys[MOCK_MAX_HOTKEYS];
+static uint32_t g_mock_hotkey_count = 0;
+static mock_device_t g_mock_devices[MOCK_MAX_DEVICES];
+static uint32_t g_mock_device_count = 0;
+static mock_file_t g_mock_files[MOCK_MAX_FILES];
+static uint32_t g_mock_file_count = 0;
+static mock_fd_t g_mock_fds[MOCK_MAX_FILES];
+static uint32_t g_mock_live = 0;
+
+/* ------------------------------------------------------------------------- */
+/* kernel_api callbacks                                                      */
+/* ------------------------------------------------------------------------- */
+
+static void mock_kprint(const char* str, int color) {
+    (void)color;
+    fputs(str, stderr);
+}
+
+static int mock_vfs_pseudo_register(const char* filename, vfs_dev_read_t read_fn,
+                                    vfs_dev_write_t write_fn, vfs_dev_seek_t seek_fn,
+                                    vfs_dev_ioctl_t ioctl_fn, void* dev_data) {
+    if (g_mock_device_count == MOCK_MAX_DEVICES || strlen(filename) >= MAX_FILENAME) return -1;
+
+    mock_device_t* dev = &g_mock_devices[g_mock_device_count++];
+    strcpy(dev->name, filename);
+    dev->read = read_fn;
+    dev->write = write_fn;
+    dev->seek = seek_fn;
+    dev->ioctl = ioctl_fn;
+    dev->data = dev_data;
+    dev->pos = 0;
+    return 0;
+}
+
+static void* mock_kmalloc(size_t size) {
+    void* ptr = malloc(size);
+    if (ptr) g_mock_live++;
+    return ptr;
+}
+
+static void mock_kfree(void* ptr) {
+    if (!ptr) return;
+    g_mock_live--;
+    free(ptr);
+}
+
+static int mock_register_hotkey(int scancode, int modifiers, void (*callback)(void*), void* data) {
+    if (g_mock_hotkey_count == MOCK_MAX_HOTKEYS) return -1;
+
+    mock_hotkey_t* hk = &g_mock_hotkeys[g_mock_hotkey_count];
+    hk->scancode = scancode;
+    hk->modifiers = modifiers;
+    hk->callback = callback;
+    hk->data = data;
+    hk->active = 1;
+    return (int)g_mock_hotkey_count++;
+}
+
+static void mock_unregister_hotkey(int id) {
+    if (id >= 0 && (uint32_t)id < g_mock_hotkey_count) g_mock_hotkeys[id].active = 0;
+}
+
+/* The legacy single-framebuffer calls describe output 0 */
+static void* mock_get_framebuffer(void) {
+    return g_mock_outputs[0].fb;
+}
+
+static void mock_get_fb_dimensions(uint32_t* width, uint32_t* height, uint32_t* pitch) {
+    const mock_output_t* out = &g_mock_outputs[0];
+    *width = out->width;
+    *height = out->height;
+    *pitch = 0;  /* no defined unit on the kernel; the module must not use it */
+}
+
+static uint32_t mock_get_fb_pitch_pixels(void) {
+    return g_mock_outputs[0].pitch;
+}
+
+static int mock_get_fb_format(struct fb_format* format) {
+    *format = g_mock_outputs[0].format;
+    return 0;
+}
+
+static uint32_t mock_fb_count(void) {
+    return g_mock_output_count;
+}
+
+static int mock_fb_get_info(uint32_t index, struct fb_info* info) {
+    if (index >= g_mock_output_count) return -1;
+
+    const mock_output_t* out = &g_mock_outputs[index];
+    info->base = out->fb;
+    info->width = out->width;
+    info->height = out->height;
+    info->pitch = out->pitch * (out->format.bpp / 8);
+    info->format = out->format;
+    return 0;
+}
+
+static int mock_register_mode_change(void (*callback)(void*), void* data) {
+    if (g_mock_mode_handler_count == MOCK_MAX_MODE_HANDLERS) return -1;
+
+    g_mock_mode_handlers[g_mock_mode_handler_count].callback = callback;
+    g_mock_mode_handlers[g_mock_mode_handler_count].data = data;
+    g_mock_mode_handler_count++;
+    return 0;
+}
+
+static int mock_vfs_open(const char* filename, int flags) {
+    if (flags & ~VFS_READ) return -1;
+
+    for (uint32_t i = 0; i < g_mock_file_count; i++) {
+        if (strcmp(g_mock_files[i].name, filename) != 0) continue;
+        for (uint32_t fd = 0; fd < MOCK_MAX_FILES; fd++) {
+            if (g_mock_fds[fd].open) continue;
+            g_mock_fds[fd].file = &g_mock_files[i];
+            g_mock_fds[fd].pos = 0;
+            g_mock_fds[fd].open = 1;
+            return (int)fd + MOCK_FD_BASE;
+        }
+        return -1;
+    }
+    return -1;
+}
+
+static mock_fd_t* mock_fd(int fd) {
+    if (fd < MOCK_FD_BASE || fd >= MOCK_FD_BASE + MOCK_MAX_FILES) return NULL;
+    mock_fd_t* f = &g_mock_fds[fd - MOCK_FD_BASE];
+    return f->open ? f : NULL;
+}
+
+static vfs_ssize_t mock_vfs_readfd(int fd, void* buf, size_t count) {
+    mock_fd_t* f = mock_fd(fd);
+    if (!f) return -1;
+
+    size_t left = f->file->size - f->pos;
+    if (count > left) count = left;
+    memcpy(buf, f->file->data + f->pos, count);
+    f->pos += count;
+    return (vfs_ssize_t)count;
+}
+
+static int mock_vfs_close(int fd) {
+    mock_fd_t* f = mock_fd(fd);
+    if (!f) return -1;
+    f->open = 0;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Harness interface                                                         */
+/* ------------------------------------------------------------------------- */
+
+/* Gives an output a cleared framebuffer in the current format; the old one is freed after */
+static int mock_output_alloc(mock_output_t* out, uint32_t width, uint32_t height, uint32_t pitch_pixels) {
+    if (pitch_pixels == 0) pitch_pixels = width;
+    if (width == 0 || height == 0 || pitch_pixels < width) return -1;
+
+    uint8_t* fb = calloc((size_t)pitch_pixels * height, g_mock_format.bpp / 8);
+    if (!fb) return -1;
+    free(out->fb);
+    out->fb = fb;
+    out->width = width;
+    out->height = height;
+    out->pitch = pitch_pixels;
+    out->format = g_mock_format;
+    return 0;
+}
+
+struct kernel_api* mock_kernel_init(uint32_t width, uint32_t height, uint32_t pitch_pixels) {
+    mock_kernel_shutdown();
+    if (mock_output_alloc(&g_mock_outputs[0], width, height, pitch_pixels) < 0) return NULL;
+    g_mock_output_count = 1;
+
+    g_mock_api.api_magic = KERNEL_API_MAGIC;
+    g_mock_api.api_size = sizeof(g_mock_api);
+    g_mock_api.kprint = mock_kprint;
+    g_mock_api.vfs_pseudo_register = mock_vfs_pseudo_register;
+    g_mock_api.kmalloc = mock_kmalloc;
+    g_mock_api.kfree = mock_kfree;
+    g_mock_api.keyboard_register_hotkey = mock_register_hotkey;
+    g_mock_api.keyboard_unregister_hotkey = mock_unregister_hotkey;
+    g_mock_api.get_framebuffer = mock_get_framebuffer;
+    g_mock_api.get_fb_dimensions = mock_get_fb_dimensions;
+    g_mock_api.get_fb_pitch_pixels = mock_get_fb_pitch_pixels;
+    g_mock_api.vfs_open = mock_vfs_open;
+    g_mock_api.vfs_readfd = mock_vfs_readfd;
+    g_mock_api.vfs_close = mock_vfs_close;
+    g_mock_api.get_fb_format = g_mock_has_format ? mock_get_fb_format : NULL;
+    g_mock_api.fb_register_mode_change = mock_register_mode_change;
+    g_mock_api.fb_count = NULL;
+    g_mock_api.fb_get_info = NULL;
+    return &g_mock_api;
+}
+
+int mock_kernel_add_output(uint32_t width, uint32_t height, uint32_t pitch_pixels) {
+    if (g_mock_output_count == 0 || g_mock_output_count == MOCK_MAX_OUTPUTS) return -1;
+
+    mock_output_t* out = &g_mock_outputs[g_mock_output_count];
+    if (mock_output_alloc(out, width, height, pitch_pixels) < 0) return -1;
+    g_mock_api.fb_count = mock_fb_count;
+    g_mock_api.fb_get_info = mock_fb_get_info;
+    return (int)g_mock_output_count++;
+}
+
+/*
+ * Copies a table so that it ends right at an unmapped page, as an older
+ * kernel's table would end at memory the module must not read: any read past
+ * `size` faults instead of picking up a stale member.
+ */
+static void* mock_guarded_copy(const void* table, size_t size) {
+    static uint8_t* pages;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (!pages) {
+        void* p = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return NULL;
+        pages = p;
+        if (mprotect(pages + page, page, PROT_NONE) < 0) return NULL;
+    }
+    if (size > page) return NULL;
+    memcpy(pages + page - size, table, size);
+    return pages + page - size;
+}
+
+struct kernel_api* mock_kernel_api_sized(size_t size) {
+    size_t baseline = __builtin_offsetof(struct kernel_api, get_fb_pitch_pixels) +
+                      sizeof(g_mock_api.get_fb_pitch_pixels);
+    if (size < baseline || size > sizeof(g_mock_api) || size % sizeof(void*) != 0) return NULL;
+    g_mock_api.api_size = size;
+    struct kernel_api* api = mock_guarded_copy(&g_mock_api, size);
+    g_mock_api.api_size = sizeof(g_mock_api);
+    return api;
+}
+
+struct kernel_api* mock_kernel_api_v0(void) {
+    struct kernel_api_v0 v0 = {
+        .kprint = g_mock_api.kprint,
+        .vfs_pseudo_register = g_mock_api.vfs_pseudo_register,
+        .kmalloc = g_mock_api.kmalloc,
+        .kfree = g_mock_api.kfree,
+        .keyboard_register_hotkey = g_mock_api.keyboard_register_hotkey,
+        .keyboard_unregister_hotkey = g_mock_api.keyboard_unregister_hotkey,
+        .get_framebuffer = g_mock_api.get_framebuffer,
+        .get_fb_dimensions = g_mock_api.get_fb_dimensions,
+        .get_fb_pitch_pixels = g_mock_api.get_fb_pitch_pixels,
+    };
+    return mock_guarded_copy(&v0, sizeof(v0));
+}
+
+int mock_select_output(uint32_t index) {
+    if (index >= g_mock_output_count) return -1;
+    g_mock_selected = index;
+    return 0;
+}
+
+uint32_t mock_output_count(void) {
+    return g_mock_output_count;
+}
+
+int mock_kernel_set_mode(uint32_t width, uint32_t height, uint32_t pitch_pixels) {
+    if (mock_output_alloc(&g_mock_outputs[g_mock_selected], width, height, pitch_pixels) < 0) return -1;
+    g_mock_api.get_fb_format = g_mock_has_format ? mock_get_fb_format : NULL;
+
+    for (uint32_t i = 0; i < g_mock_mode_handler_count; i++) {
+        g_mock_mode_handlers[i].callback(g_mock_mode_handlers[i].data);
+    }
+    return 0;
+}
+
+/* Forgets registrations; memory still held by the module is not reclaimed */
+void mock_kernel_shutdown(void) {
+    for (uint32_t i = 0; i < g_mock_output_count; i++) free(g_mock_outputs[i].fb);
+    memset(g_mock_outputs, 0, sizeof(g_mock_outputs));
+    g_mock_output_count = 0;
+    g_mock_selected = 0;
+    g_mock_hotkey_count = 0;
+    g_mock_mode_handler_count = 0;
+    g_mock_device_count = 0;
+    g_mock_file_count = 0;
+    memset(g_mock_fds, 0, sizeof(g_mock_fds));
+}
+
+void mock_kernel_set_format(const struct fb_format* format) {
+    static const struct fb_format xrgb8888 = { 32, 0xFF0000, 0x00FF00, 0x0000FF };
+    g_mock_has_format = format != NULL;
+    g_mock_format = format ? *format : xrgb8888;
+}
+
+const struct fb_format* mock_fb_format(const char* name) {
+    for (uint32_t i = 0; i < sizeof(MOCK_FORMATS) / sizeof(MOCK_FORMATS[0]); i++) {
+        if (strcmp(MOCK_FORMATS[i].name, name) == 0) return &MOCK_FORMATS[i].format;
+    }
+    return NULL;
+}
+
+uint8_t* mock_framebuffer(void) {
+    return g_mock_outputs[g_mock_selected].fb;
+}
+
+uint32_t mock_fb_width(void) {
+    return g_mock_outputs[g_mock_selected].width;
+}
+
+uint32_t mock_fb_height(void) {
+    return g_mock_outputs[g_mock_selected].height;
+}
+
+uint32_t mock_fb_pitch(void) {
+    return mock_fb_pitch_pixels() * mock_fb_bytes_per_pixel();
+}
+
+uint32_t mock_fb_pitch_pixels(void) {
+    return g_mock_outputs[g_mock_selected].pitch;
+}
+
+uint32_t mock_fb_bytes_per_pixel(void) {
+    return g_mock_outputs[g_mock_selected].format.bpp / 8;
+}
+
+/* Scales a channel of any width to 8 bits */
+static uint32_t mock_channel(uint32_t value, uint32_t mask) {
+    if (mask == 0) return 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        value >>= 1;
+    }
+    return (value & mask) * 255 / mask;
+}
+
+uint32_t mock_fb_pixel(uint32_t x, uint32_t y) {
+    const struct fb_format* format = &g_mock_outputs[g_mock_selected].format;
+    uint32_t bytes = mock_fb_bytes_per_pixel();
+    const uint8_t* p = &mock_framebuffer()[(size_t)y * mock_fb_pitch() + (size_t)x * bytes];
+    uint32_t value = 0;
+    for (uint32_t b = 0; b < bytes; b++) value |= (uint32_t)p[b] << (8 * b);
+
+    return mock_channel(value, format->red_mask) << 16 |
+           mock_channel(value, format->green_mask) << 8 |
+           mock_channel(value, format->blue_mask);
+}
+
+int mock_framebuffer_save_ppm(const char* path) {
+    FILE* f = fopen(path, "wb");
+    if (!f) return -1;
+
+    fprintf(f, "P6\n%u %u\n255\n", mock_fb_width(), mock_fb_height());
+    for (uint32_t y = 0; y < mock_fb_height(); y++) {
+        for (uint32_t x = 0; x < mock_fb_width(); x++) {
+            uint32_t pixel = mock_fb_pixel(x, y);
+            uint8_t rgb[3] = { (uint8_t)(pixel >> 16), (uint8_t)(pixel >> 8), (uint8_t)pixel };
+            fwrite(rgb, 1, sizeof(rgb), f);
+        }
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+int mock_press_hotkey(int scancode, int modifiers) {
+    for (uint32_t i = 0; i < g_mock_hotkey_count; i++) {
+        mock_hotkey_t* hk = &g_mock_hotkeys[i];
+        if (hk->active && hk->scancode == scancode && hk->modifiers == modifiers) {
+            hk->callback(hk->data);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const mock_hotkey_t* mock_hotkeys(uint32_t* count) {
+    *count = g_mock_hotkey_count;
+    return g_mock_hotkeys;
+}
+
+mock_device_t* mock_find_device(const char* name) {
+    for (uint32_t i = 0; i < g_mock_device_count; i++) {
+        if (strcmp(g_mock_devices[i].name, name) == 0) return &g_mock_devices[i];
+    }
+    return NULL;
+}
+
+vfs_ssize_t mock_dev_write(const char* name, const void* buf, size_t count) {
+    mock_device_t* dev = mock_find_device(name);
+    if (!dev || !dev->write) return -1;
+    return dev->write(NULL, buf, count, &dev->pos);
+}
+
+vfs_ssize_t mock_dev_read(const char* name, void* buf, size_t count) {
+    mock_device_t* dev = mock_find_device(name);
+    if (!dev || !dev->read) return -1;
+    return dev->read(NULL, buf, count, &dev->pos);
+}
+
+vfs_off_t mock_dev_seek(const char* name, vfs_off_t offset, int whence) {
+    mock_device_t* dev = mock_find_device(name);
+    if (!dev) return -1;
+    if (!dev->seek) {
+        if (whence != VFS_SEEK_SET) return -1;
+        dev->pos = offset;
+        return offset;
+    }
+    return dev->seek(NULL, offset, whence, &dev->pos);
+}
+
+int mock_dev_ioctl(const char* name, unsigned long request, void* arg) {
+    mock_device_t* dev = mock_find_device(name);
+    if (!dev || !dev->ioctl) return -1;
+    return dev->ioctl(NULL, request, arg);
+}
+
+int mock_vfs_add_file(const char* name, const void* data, size_t size) {
+    if (g_mock_file_count == MOCK_MAX_FILES || strlen(name) >= MAX_FILENAME) return -1;
+
+    mock_file_t* file = &g_mock_files[g_mock_file_count++];
+    strcpy(file->name, name);
+    file->data = data;
+    file->size = size;
+    return 0;
+}
+
+uint32_t mock_live_allocations(void) {
+    return g_mock_live;
+}
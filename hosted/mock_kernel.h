@@ -0,0 +1,110 @@
+#ifndef MOCK_KERNEL_H
+#define MOCK_KERNEL_H
+
+#include <sdk.h>
+
+// Hosted stand-in for the NovariaOS kernel_api. The module is built with
+// -D_start=nrio_module_start so it links into a normal Linux program; tests
+// and benchmarks boot it with mock_kernel_api() and then drive it through the
+// recorded hotkeys and pseudo-devices.
+
+#define MOCK_MAX_HOTKEYS 32
+#define MOCK_MAX_DEVICES 16
+#define MOCK_MAX_FILES   8
+#define MOCK_MAX_MODE_HANDLERS 4
+#define MOCK_MAX_OUTPUTS 4
+
+typedef struct {
+    int scancode;
+    int modifiers;
+    void (*callback)(void*);
+    void* data;
+    int active;
+} mock_hotkey_t;
+
+typedef struct {
+    char name[MAX_FILENAME];
+    vfs_dev_read_t read;
+    vfs_dev_write_t write;
+    vfs_dev_seek_t seek;
+    vfs_dev_ioctl_t ioctl;
+    void* data;
+    vfs_off_t pos;          // file position shared by all mock_dev_* calls
+} mock_device_t;
+
+// Module entry point, renamed from _start at compile time
+void nrio_module_start(struct kernel_api* api);
+
+// Allocates a width x height framebuffer with pitch_pixels per row (0 means
+// width) and returns the api table. Returns NULL on bad sizes or no memory.
+struct kernel_api* mock_kernel_init(uint32_t width, uint32_t height, uint32_t pitch_pixels);
+void mock_kernel_shutdown(void);
+
+// Adds another framebuffer in the current format, after mock_kernel_init()
+// and before the module starts. With more than one, fb_count and fb_get_info
+// are set. Returns the new output's index, or -1 on bad sizes, no memory or
+// too many outputs.
+int mock_kernel_add_output(uint32_t width, uint32_t height, uint32_t pitch_pixels);
+uint32_t mock_output_count(void);
+
+// Tables of older kernels, to pass to the module instead of the one from
+// mock_kernel_init(). mock_kernel_api_sized() copies the first `size` bytes
+// of the current table with api_size set to match; it returns NULL unless
+// `size` covers the baseline members and ends on a member boundary.
+// mock_kernel_api_v0() gives the baseline members as a struct kernel_api_v0,
+// without api_magic. Either copy ends at an unmapped page, so a read past it
+// faults. Call them after the outputs are added; each call replaces the last
+// copy.
+struct kernel_api* mock_kernel_api_sized(size_t size);
+struct kernel_api* mock_kernel_api_v0(void);
+
+// Output that the framebuffer accessors below and mock_kernel_set_mode() use;
+// 0 after mock_kernel_init(). Returns -1 for an index out of range.
+int mock_select_output(uint32_t index);
+
+// Switches the selected output's mode like a kernel modeset: a cleared
+// framebuffer of the new size (and the current format) replaces the old one,
+// which is freed, and the handlers registered through fb_register_mode_change
+// run. Returns -1 on bad sizes or no memory, leaving the old mode in place.
+int mock_kernel_set_mode(uint32_t width, uint32_t height, uint32_t pitch_pixels);
+
+// Pixel format used by the next mock_kernel_init(), mock_kernel_add_output()
+// or mock_kernel_set_mode().
+// NULL, the default, leaves get_fb_format unset like older kernels, which
+// means 32bpp xRGB8888.
+void mock_kernel_set_format(const struct fb_format* format);
+
+// Named layouts: xrgb8888, xbgr8888, rgb888, bgr888, rgb565, bgr565 and
+// rgb555. Returns NULL for other names.
+const struct fb_format* mock_fb_format(const char* name);
+
+// Selected output's framebuffer; the pitch is in bytes
+uint8_t* mock_framebuffer(void);
+uint32_t mock_fb_width(void);
+uint32_t mock_fb_height(void);
+uint32_t mock_fb_pitch(void);
+uint32_t mock_fb_pitch_pixels(void);
+uint32_t mock_fb_bytes_per_pixel(void);
+// Pixel at x, y decoded to 0xRRGGBB
+uint32_t mock_fb_pixel(uint32_t x, uint32_t y);
+int mock_framebuffer_save_ppm(const char* path);
+
+// Hotkeys: runs the callback registered for scancode and modifiers.
+// Returns 0 if one was found, -1 otherwise.
+int mock_press_hotkey(int scancode, int modifiers);
+const mock_hotkey_t* mock_hotkeys(uint32_t* count);
+
+// Pseudo-devices registered by the module
+mock_device_t* mock_find_device(const char* name);
+vfs_ssize_t mock_dev_write(const char* name, const void* buf, size_t count);
+vfs_ssize_t mock_dev_read(const char* name, void* buf, size_t count);
+vfs_off_t mock_dev_seek(const char* name, vfs_off_t offset, int whence);
+int mock_dev_ioctl(const char* name, unsigned long request, void* arg);
+
+// Regular files visible to vfs_open/vfs_readfd; data is not copied
+int mock_vfs_add_file(const char* name, const void* data, size_t size);
+
+// Outstanding kmalloc blocks
+uint32_t mock_live_allocations(void);
+
+#endif
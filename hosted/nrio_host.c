@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nrio.h>
+#include "mock_kernel.h"
+
+/*
+ * Runs nRio on a mock kernel: boots the module into a malloc'd framebuffer,
+ * writes each command argument to the control device and optionally saves
+ * the final frame as a PPM image. Builds with NRIO_TRACE can also save the
+ * trace device's JSON.
+ */
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-w width] [-h height] [-p pitch_pixels] [-F format] [-f font.psf] [-o out.ppm] [-t trace.json] [command...]\n",
+            prog);
+}
+
+static void* read_file(const char* path, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    uint8_t* data = NULL;
+    size_t len = 0, cap = 0, n;
+    do {
+        if (len == cap) {
+            cap = cap ? cap * 2 : 65536;
+            uint8_t* grown = realloc(data, cap);
+            if (!grown) {
+                free(data);
+                fclose(f);
+                return NULL;
+            }
+            data = grown;
+        }
+        n = fread(data + len, 1, cap - len, f);
+        len += n;
+    } while (n > 0);
+
+    fclose(f);
+    *size = len;
+    return data;
+}
+
+/* Copies a pseudo-device's contents from offset 0 into a file */
+static int save_device(const char* name, const char* path) {
+    if (!mock_find_device(name)) {
+        fprintf(stderr, "%s is not registered\n", name);
+        return -1;
+    }
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    char buf[4096];
+    vfs_ssize_t n;
+    mock_dev_seek(name, 0, VFS_SEEK_SET);
+    while ((n = mock_dev_read(name, buf, sizeof(buf))) > 0) {
+        fwrite(buf, 1, (size_t)n, f);
+    }
+    return fclose(f) == 0 && n == 0 ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+    uint32_t width = 1024, height = 768, pitch = 0;
+    const char* font_path = NULL;
+    const char* out_path = NULL;
+    const char* trace_path = NULL;
+    const char* format = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:h:p:F:f:o:t:")) != -1) {
+        switch (opt) {
+            case 'w': width = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'h': height = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'p': pitch = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'F': format = optarg; break;
+            case 'f': font_path = optarg; break;
+            case 'o': out_path = optarg; break;
+            case 't': trace_path = optarg; break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (format) {
+        const struct fb_format* fmt = mock_fb_format(format);
+        if (!fmt) {
+            fprintf(stderr, "unknown format %s\n", format);
+            return 2;
+        }
+        mock_kernel_set_format(fmt);
+    }
+
+    struct kernel_api* api = mock_kernel_init(width, height, pitch);
+    if (!api) {
+        fprintf(stderr, "bad framebuffer size %ux%u pitch %u\n", width, height, pitch);
+        return 2;
+    }
+
+    void* font = NULL;
+    if (font_path) {
+        size_t size;
+        font = read_file(font_path, &size);
+        if (!font) {
+            perror(font_path);
+            return 1;
+        }
+        mock_vfs_add_file(NRIO_FONT_PATH, font, size);
+    }
+
+    nrio_module_start(api);
+
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        size_t len = strlen(argv[i]);
+        char* line = malloc(len + 2);
+        if (!line) return 1;
+        memcpy(line, argv[i], len);
+        line[len] = '\n';
+        if (mock_dev_write(NRIO_CONTROL_DEVICE, line, len + 1) < 0) {
+            fprintf(stderr, "rejected: %s\n", argv[i]);
+            status = 1;
+        }
+        free(line);
+    }
+
+    if (out_path && mock_framebuffer_save_ppm(out_path) < 0) {
+        perror(out_path);
+        status = 1;
+    }
+
+    if (trace_path && save_device(NRIO_TRACE_DEVICE, trace_path) < 0) status = 1;
+
+    free(font);
+    return status;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Built as one unit with the WM so the per-pixel write counters are reachable */
+#include "../src/main.c"
+#include "mock_kernel.h"
+
+/*
+ * Overdraw report: boots the module, writes each command argument to the
+ * control device and prints, for every frame that produced, the number of
+ * pixel writes, distinct pixels written and the overdraw factor. Heatmaps
+ * of each frame can be saved as PPM images.
+ */
+
+#ifndef NRIO_OVERDRAW
+#error "overdraw needs -DNRIO_OVERDRAW"
+#endif
+
+/* Heatmap colors by writes per pixel; the last entry covers everything above */
+static const uint8_t HEAT_COLORS[][3] = {
+    {   0,   0,   0 },  /* untouched */
+    {  32,  64, 160 },  /* written once */
+    {  40, 170,  80 },
+    { 230, 200,  40 },
+    { 230, 110,  30 },
+    { 220,  30,  30 },  /* 5 or more */
+};
+
+#define HEAT_LEVELS (sizeof(HEAT_COLORS) / sizeof(HEAT_COLORS[0]))
+
+static int save_heatmap(const char* path) {
+    FILE* f = fopen(path, "wb");
+    if (!f) return -1;
+
+    const output_t* out = &g_outputs[0];
+    fprintf(f, "P6\n%u %u\n255\n", out->width, out->height);
+    for (uint32_t i = 0; i < out->width * out->height; i++) {
+        uint32_t level = out->overdraw[i] < HEAT_LEVELS ? out->overdraw[i] : HEAT_LEVELS - 1;
+        fwrite(HEAT_COLORS[level], 1, 3, f);
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* Prints the last finished frame and saves its heatmap when a prefix was given */
+static int report_frame(const char* label, const char* prefix) {
+    double factor = g_overdraw_unique ? (double)g_overdraw_writes / (double)g_overdraw_unique : 0;
+    printf("%5u  %-28.28s %12llu %12llu %8.2f %6u\n", g_overdraw_frames, label,
+           (unsigned long long)g_overdraw_writes, (unsigned long long)g_overdraw_unique,
+           factor, g_overdraw_max);
+
+    if (!prefix) return 0;
+    char path[512];
+    snprintf(path, sizeof(path), "%s-%03u.ppm", prefix, g_overdraw_frames);
+    if (save_heatmap(path) < 0) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-w width] [-h height] [-p pitch_pixels] [-o heatmap_prefix] [command...]\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    uint32_t width = 1024, height = 768, pitch = 0;
+    const char* prefix = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:h:p:o:")) != -1) {
+        switch (opt) {
+            case 'w': width = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'h': height = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'p': pitch = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'o': prefix = optarg; break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    struct kernel_api* api = mock_kernel_init(width, height, pitch);
+    if (!api) {
+        fprintf(stderr, "bad framebuffer size %ux%u pitch %u\n", width, height, pitch);
+        return 2;
+    }
+    nrio_module_start(api);
+    if (!g_outputs[0].overdraw) {
+        fprintf(stderr, "no memory for the overdraw map\n");
+        return 1;
+    }
+
+    printf("%5s  %-28s %12s %12s %8s %6s\n", "frame", "command", "writes", "unique", "factor", "max");
+    int status = report_frame("(startup)", prefix) < 0;
+    uint64_t total_writes = g_overdraw_writes, total_unique = g_overdraw_unique;
+
+    for (int i = optind; i < argc; i++) {
+        uint32_t frames = g_overdraw_frames;
+        size_t len = strlen(argv[i]);
+        char* line = malloc(len + 2);
+        if (!line) return 1;
+        memcpy(line, argv[i], len);
+        line[len] = '\n';
+        if (mock_dev_write(NRIO_CONTROL_DEVICE, line, len + 1) < 0) {
+            fprintf(stderr, "rejected: %s\n", argv[i]);
+            status = 1;
+        }
+        free(line);
+
+        if (g_overdraw_frames == frames) {
+            printf("%5s  %-28.28s %12s\n", "-", argv[i], "no frame");
+            continue;
+        }
+        if (report_frame(argv[i], prefix) < 0) status = 1;
+        total_writes += g_overdraw_writes;
+        total_unique += g_overdraw_unique;
+    }
+
+    printf("%5s  %-28s %12llu %12llu %8.2f\n", "", "total",
+           (unsigned long long)total_writes, (unsigned long long)total_unique,
+           total_unique ? (double)total_writes / (double)total_unique : 0);
+    return status;
+}
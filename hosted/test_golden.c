@@ -0,0 +1,492 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <nrio.h>
+#include "mock_kernel.h"
+
+/* After the SDK headers: its st_mtime macro would rename a vfs_stat field */
+#include <sys/stat.h>
+
+/*
+ * Golden-image regression test: replays scripted hotkey and control-device
+ * sequences at several resolutions and compares a hash of the framebuffer
+ * after every step with hosted/golden/frames.txt. Each case runs in a forked
+ * child so it starts from a freshly booted module.
+ *
+ * The hashes only show that a frame did not change. Cases in another pixel
+ * format are also checked for correctness: every pixel is decoded and must
+ * equal the same step's xRGB8888 frame truncated to the format's channel
+ * depths. A forked reference run streams those frames through a pipe.
+ *
+ * -u rewrites the golden file. -i DIR saves every frame there when updating
+ * and is where the expected images are read from when checking. Only the
+ * hashes are checked in: the images exist once -u -i golden-images has run,
+ * which should be on a known-good tree (the golden file then stays as it
+ * was). Every mismatching frame is written to the -o directory, created on
+ * the first one, as <frame>.actual.ppm and, from the golden image,
+ * <frame>.expected.ppm and <frame>.diff.ppm; the paths are printed.
+ */
+
+#define GOLDEN_DEFAULT_PATH "hosted/golden/frames.txt"
+#define GOLDEN_IMAGE_DIR "golden-images"
+#define GOLDEN_OUT_DIR "golden-failures"
+#define GOLDEN_MAX_ENTRIES 4096
+#define CASE_NAME_MAX 96
+#define HOTKEY_MODIFIERS 1
+
+typedef struct {
+    const char* name;
+    const char* const* steps;    /* single letters are hotkeys, anything else a command */
+} golden_scenario_t;
+
+typedef struct {
+    uint32_t width, height, pitch;
+    const char* format;          /* NULL for a kernel without get_fb_format */
+} golden_resolution_t;
+
+typedef struct {
+    char name[CASE_NAME_MAX];
+    uint32_t step;
+    uint64_t hash;
+} golden_entry_t;
+
+static const struct {
+    char key;
+    int scancode;
+} HOTKEYS[] = {
+    { 'n', 0x11 },
+    { 'c', 0x10 },
+    { 'l', 0x26 },
+    { 'f', 0x20 },
+    { 'h', 0x32 },
+    { 's', 0x13 },
+};
+
+static const char* const STEPS_OPEN_CYCLE_CLOSE[] = {
+    "n", "n", "n", "n", "n", "n", "l", "l", "l", "l", "l",
+    "f", "f", "f", "c", "c", "c", "c", "c", "c", NULL
+};
+
+static const char* const STEPS_LAYOUTS[] = {
+    "new one", "layout horizontal", "layout vertical", "layout fullscreen", "layout master",
+    "new two", "new three", "ratio 30", "ratio 80", "layout grid", "focus prev", "close",
+    "layout master", "close", "close", NULL
+};
+
+static const char* const STEPS_SCRATCHPAD[] = {
+    "n", "n", "n", "n", "h", "h", "s", "f", "h", "s", "s", "c", "c", "c", "c", NULL
+};
+
+static const char* const STEPS_TITLES[] = {
+    "new editor", "new shell", "title 1 renamed editor", "titles off", "new logs",
+    "titles on", "focus 2", "title 2 a much longer title that gets clipped", "layout vertical",
+    "close 1", NULL
+};
+
+static const char* const STEPS_WORKSPACES[] = {
+    "n", "n", "workspace 2", "n", "l", "workspace 1", "c", "workspace 2", "c", "workspace 1",
+    "c", NULL
+};
+
+static const golden_scenario_t SCENARIOS[] = {
+    { "open-cycle-close", STEPS_OPEN_CYCLE_CLOSE },
+    { "layouts", STEPS_LAYOUTS },
+    { "scratchpad", STEPS_SCRATCHPAD },
+    { "titles", STEPS_TITLES },
+    { "workspaces", STEPS_WORKSPACES },
+};
+
+static const golden_resolution_t RESOLUTIONS[] = {
+    { 640, 480, 0, NULL },
+    { 1024, 768, 1040, NULL },
+    { 1920, 1080, 0, NULL },
+    { 800, 600, 0, "xbgr8888" },
+    { 800, 600, 803, "rgb888" },
+    { 800, 600, 0, "bgr888" },
+    { 800, 600, 810, "rgb565" },
+    { 800, 600, 0, "rgb555" },
+};
+
+static golden_entry_t g_golden[GOLDEN_MAX_ENTRIES];
+static uint32_t g_golden_count = 0;
+
+/* Reference run for a format case, streaming xRGB8888 frames in lockstep */
+typedef struct {
+    pid_t pid;
+    FILE* frames;
+    uint32_t* pixels;            /* the current step's frame */
+    uint32_t keep_mask;          /* bits of 0xRRGGBB that survive the format */
+} golden_reference_t;
+
+/* FNV-1a over the bytes of the visible pixels, row by row, so pitch padding is ignored */
+static uint64_t framebuffer_hash(void) {
+    uint32_t row_bytes = mock_fb_width() * mock_fb_bytes_per_pixel();
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t y = 0; y < mock_fb_height(); y++) {
+        const uint8_t* row = &mock_framebuffer()[(size_t)y * mock_fb_pitch()];
+        for (uint32_t i = 0; i < row_bytes; i++) {
+            hash ^= row[i];
+            hash *= 0x100000001b3ull;
+        }
+    }
+    return hash;
+}
+
+static const golden_entry_t* find_golden(const char* name, uint32_t step) {
+    for (uint32_t i = 0; i < g_golden_count; i++) {
+        if (g_golden[i].step == step && strcmp(g_golden[i].name, name) == 0) return &g_golden[i];
+    }
+    return NULL;
+}
+
+static int load_golden(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        golden_entry_t* e = &g_golden[g_golden_count];
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (g_golden_count == GOLDEN_MAX_ENTRIES ||
+            sscanf(line, "%95s %" SCNu32 " %" SCNx64, e->name, &e->step, &e->hash) != 3) {
+            fclose(f);
+            return -1;
+        }
+        g_golden_count++;
+    }
+    fclose(f);
+    return 0;
+}
+
+static uint32_t* read_ppm(const char* path, uint32_t width, uint32_t height) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    uint32_t w, h, max;
+    uint32_t* pixels = NULL;
+    if (fscanf(f, "P6 %u %u %u", &w, &h, &max) == 3 && fgetc(f) != EOF &&
+        w == width && h == height && max == 255) {
+        pixels = malloc((size_t)w * h * sizeof(uint32_t));
+        for (size_t i = 0; pixels && i < (size_t)w * h; i++) {
+            uint8_t rgb[3];
+            if (fread(rgb, 1, 3, f) != 3) {
+                free(pixels);
+                pixels = NULL;
+                break;
+            }
+            pixels[i] = ((uint32_t)rgb[0] << 16) | ((uint32_t)rgb[1] << 8) | rgb[2];
+        }
+    }
+    fclose(f);
+    return pixels;
+}
+
+/* Writes the expected image and a diff that marks differing pixels in red */
+static void dump_expected(const char* image_dir, const char* out_dir, const char* frame) {
+    uint32_t width = mock_fb_width(), height = mock_fb_height();
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.ppm", image_dir, frame);
+    uint32_t* expected = read_ppm(path, width, height);
+    if (!expected) {
+        fprintf(stderr, "  expected: no golden image at %s; record them on a known-good tree with -u -i %s\n",
+                path, image_dir);
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s.expected.ppm", out_dir, frame);
+    FILE* f = fopen(path, "wb");
+    if (f) {
+        fprintf(stderr, "  expected: %s\n", path);
+        fprintf(f, "P6\n%u %u\n255\n", width, height);
+        for (size_t i = 0; i < (size_t)width * height; i++) {
+            uint8_t rgb[3] = { (uint8_t)(expected[i] >> 16), (uint8_t)(expected[i] >> 8), (uint8_t)expected[i] };
+            fwrite(rgb, 1, 3, f);
+        }
+        fclose(f);
+    }
+
+    uint32_t first_x = 0, first_y = 0, diffs = 0;
+    snprintf(path, sizeof(path), "%s/%s.diff.ppm", out_dir, frame);
+    f = fopen(path, "wb");
+    if (f) {
+        fprintf(stderr, "  diff:     %s\n", path);
+        fprintf(f, "P6\n%u %u\n255\n", width, height);
+    }
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t actual = mock_fb_pixel(x, y);
+            uint32_t want = expected[(size_t)y * width + x];
+            uint8_t rgb[3] = { 0, 0, 0 };
+            if (actual != want) {
+                if (diffs++ == 0) {
+                    first_x = x;
+                    first_y = y;
+                }
+                rgb[0] = 255;
+            } else {
+                rgb[1] = rgb[2] = (uint8_t)((actual & 0xff) / 4);
+            }
+            if (f) fwrite(rgb, 1, 3, f);
+        }
+    }
+    if (f) fclose(f);
+    if (diffs) fprintf(stderr, "  %u pixels differ, first at (%u, %u)\n", diffs, first_x, first_y);
+    free(expected);
+}
+
+static uint32_t channel_bits(uint32_t mask) {
+    return (uint32_t)__builtin_popcount(mask);
+}
+
+static int run_step(const char* step);
+
+/*
+ * Forks a run of the scenario at the same size in xRGB8888 that writes its
+ * decoded frame after startup and after every step. Call it before the
+ * case's own module starts.
+ */
+static int reference_start(golden_reference_t* ref, const golden_scenario_t* sc,
+                           const golden_resolution_t* res) {
+    const struct fb_format* format = mock_fb_format(res->format);
+    int fds[2];
+    if (!format || pipe(fds) < 0) return -1;
+
+    ref->keep_mask = 0;
+    const uint32_t masks[3] = { format->red_mask, format->green_mask, format->blue_mask };
+    for (uint32_t c = 0; c < 3; c++) {
+        uint32_t bits = channel_bits(masks[c]);
+        ref->keep_mask |= ((0xFFu << (8 - (bits < 8 ? bits : 8))) & 0xFFu) << (16 - 8 * c);
+    }
+
+    ref->pid = fork();
+    if (ref->pid < 0) return -1;
+    if (ref->pid == 0) {
+        close(fds[0]);
+        FILE* out = fdopen(fds[1], "wb");
+        uint32_t* row = malloc(res->width * sizeof(uint32_t));
+        mock_kernel_set_format(NULL);
+        struct kernel_api* api = mock_kernel_init(res->width, res->height, 0);
+        if (!out || !row || !api) _exit(1);
+        nrio_module_start(api);
+        for (uint32_t step = 0;; step++) {
+            if (step > 0 && (!sc->steps[step - 1] || run_step(sc->steps[step - 1]) < 0)) break;
+            for (uint32_t y = 0; y < res->height; y++) {
+                for (uint32_t x = 0; x < res->width; x++) row[x] = mock_fb_pixel(x, y);
+                if (fwrite(row, sizeof(uint32_t), res->width, out) != res->width) _exit(1);
+            }
+        }
+        fclose(out);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    ref->frames = fdopen(fds[0], "rb");
+    ref->pixels = malloc((size_t)res->width * res->height * sizeof(uint32_t));
+    return ref->frames && ref->pixels ? 0 : -1;
+}
+
+/* Compares the decoded framebuffer with the reference frame for the same step */
+static int reference_check(golden_reference_t* ref, const char* name, uint32_t step) {
+    uint32_t width = mock_fb_width(), height = mock_fb_height();
+    if (fread(ref->pixels, sizeof(uint32_t), (size_t)width * height, ref->frames) != (size_t)width * height) {
+        fprintf(stderr, "%s step %u: no xrgb8888 reference frame\n", name, step);
+        return -1;
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t actual = mock_fb_pixel(x, y) & ref->keep_mask;
+            uint32_t want = ref->pixels[(size_t)y * width + x] & ref->keep_mask;
+            if (actual == want) continue;
+            fprintf(stderr, "%s step %u: pixel (%u, %u) decodes to %06x, xrgb8888 truncated is %06x\n",
+                    name, step, x, y, actual, want);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void reference_stop(golden_reference_t* ref) {
+    if (ref->frames) fclose(ref->frames);
+    free(ref->pixels);
+    if (ref->pid > 0) waitpid(ref->pid, NULL, 0);
+}
+
+static int run_step(const char* step) {
+    if (step[0] && !step[1]) {
+        for (uint32_t i = 0; i < sizeof(HOTKEYS) / sizeof(HOTKEYS[0]); i++) {
+            if (HOTKEYS[i].key == step[0]) return mock_press_hotkey(HOTKEYS[i].scancode, HOTKEY_MODIFIERS);
+        }
+        return -1;
+    }
+
+    size_t len = strlen(step);
+    char line[256];
+    if (len + 1 >= sizeof(line)) return -1;
+    memcpy(line, step, len);
+    line[len] = '\n';
+    return mock_dev_write(NRIO_CONTROL_DEVICE, line, len + 1) == (vfs_ssize_t)(len + 1) ? 0 : -1;
+}
+
+/* Creates the -o directory for the first mismatching frame; 0 if it exists */
+static int out_dir_create(const char* out_dir) {
+    static int created;
+    if (created) return 0;
+    if (mkdir(out_dir, 0777) < 0 && errno != EEXIST) {
+        perror(out_dir);
+        return -1;
+    }
+    created = 1;
+    return 0;
+}
+
+/* Runs one scenario at one resolution; returns the number of failing steps */
+static int run_case(const golden_scenario_t* sc, const golden_resolution_t* res, FILE* update,
+                    const char* image_dir, const char* out_dir) {
+    char name[CASE_NAME_MAX];
+    snprintf(name, sizeof(name), "%s@%ux%u+%u%s%s", sc->name, res->width, res->height,
+             res->pitch ? res->pitch : res->width, res->format ? ":" : "",
+             res->format ? res->format : "");
+
+    golden_reference_t ref = { 0, NULL, NULL, 0 };
+    if (res->format && reference_start(&ref, sc, res) < 0) {
+        fprintf(stderr, "%s: cannot start the xrgb8888 reference run\n", name);
+        return 1;
+    }
+
+    mock_kernel_set_format(res->format ? mock_fb_format(res->format) : NULL);
+    struct kernel_api* api = mock_kernel_init(res->width, res->height, res->pitch);
+    if (!api) {
+        fprintf(stderr, "%s: cannot allocate framebuffer\n", name);
+        return 1;
+    }
+    nrio_module_start(api);
+
+    int failures = 0;
+    for (uint32_t step = 0;; step++) {
+        if (step > 0) {
+            const char* cmd = sc->steps[step - 1];
+            if (!cmd) break;
+            if (run_step(cmd) < 0) {
+                fprintf(stderr, "%s step %u: \"%s\" failed\n", name, step, cmd);
+                return failures + 1;
+            }
+        }
+
+        if (ref.frames && reference_check(&ref, name, step) < 0) {
+            /* Report the first wrong frame only; closing the pipe ends the reference run */
+            failures++;
+            reference_stop(&ref);
+            ref.frames = NULL;
+            ref.pixels = NULL;
+            ref.pid = 0;
+        }
+
+        uint64_t hash = framebuffer_hash();
+        char frame[CASE_NAME_MAX + 16];
+        snprintf(frame, sizeof(frame), "%s-%02u", name, step);
+
+        if (update) {
+            fprintf(update, "%s %u %016" PRIx64 "\n", name, step, hash);
+            if (image_dir) {
+                char path[512];
+                snprintf(path, sizeof(path), "%s/%s.ppm", image_dir, frame);
+                mock_framebuffer_save_ppm(path);
+            }
+            continue;
+        }
+
+        const golden_entry_t* golden = find_golden(name, step);
+        if (golden && golden->hash == hash) continue;
+
+        failures++;
+        if (!golden) {
+            fprintf(stderr, "%s step %u: no golden hash\n", name, step);
+            continue;
+        }
+        fprintf(stderr, "%s step %u (%s): hash %016" PRIx64 ", expected %016" PRIx64 "\n", name, step,
+                step ? sc->steps[step - 1] : "startup", hash, golden->hash);
+        if (out_dir_create(out_dir) < 0) continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s.actual.ppm", out_dir, frame);
+        if (mock_framebuffer_save_ppm(path) == 0) fprintf(stderr, "  actual:   %s\n", path);
+        dump_expected(image_dir, out_dir, frame);
+    }
+    reference_stop(&ref);
+    return failures;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-g golden.txt] [-u] [-i image_dir] [-o out_dir] [-s scenario]\n", prog);
+}
+
+int main(int argc, char** argv) {
+    const char* golden_path = GOLDEN_DEFAULT_PATH;
+    const char* image_dir = NULL;
+    const char* out_dir = GOLDEN_OUT_DIR;
+    const char* only = NULL;
+    int update = 0, opt;
+
+    while ((opt = getopt(argc, argv, "g:ui:o:s:")) != -1) {
+        switch (opt) {
+            case 'g': golden_path = optarg; break;
+            case 'u': update = 1; break;
+            case 'i': image_dir = optarg; break;
+            case 'o': out_dir = optarg; break;
+            case 's': only = optarg; break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    FILE* out = NULL;
+    if (update) {
+        if (image_dir && mkdir(image_dir, 0777) < 0 && errno != EEXIST) {
+            perror(image_dir);
+            return 2;
+        }
+        out = fopen(golden_path, "w");
+        if (!out) {
+            perror(golden_path);
+            return 2;
+        }
+        fprintf(out, "# <scenario>@<width>x<height>+<pitch>[:<format>] <step> <fnv1a-64 of the frame>\n");
+        fflush(out);
+    } else if (load_golden(golden_path) < 0) {
+        fprintf(stderr, "cannot read %s\n", golden_path);
+        return 2;
+    } else if (!image_dir) {
+        image_dir = GOLDEN_IMAGE_DIR;
+    }
+
+    uint32_t cases = 0, failed = 0;
+    for (uint32_t s = 0; s < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); s++) {
+        if (only && strcmp(only, SCENARIOS[s].name) != 0) continue;
+        for (uint32_t r = 0; r < sizeof(RESOLUTIONS) / sizeof(RESOLUTIONS[0]); r++) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                return 2;
+            }
+            if (pid == 0) {
+                int failures = run_case(&SCENARIOS[s], &RESOLUTIONS[r], out, image_dir, out_dir);
+                if (out) fflush(out);
+                _exit(failures ? 1 : 0);
+            }
+
+            int status;
+            cases++;
+            if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+        }
+    }
+
+    if (out) fclose(out);
+    printf("%u/%u golden cases %s\n", cases - failed, cases, update ? "recorded" : "passed");
+    return failed ? 1 : 0;
+}
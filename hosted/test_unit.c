@@ -0,0 +1,731 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Built as one unit with the WM so the checks can look at its internal state */
+#include "../src/main.c"
+#include "mock_kernel.h"
+
+/*
+ * Hosted unit tests for the control protocol, the module's other parsers and
+ * its use of the kernel_api. Built with NRIO_TRACE, it also checks the trace
+ * device.
+ * Each test runs in a forked child on a freshly booted module, so a crash or
+ * a failed check in one never affects the next.
+ */
+
+#define TEST_WIDTH 640
+#define TEST_HEIGHT 480
+#define TEST_FONT_MAX (sizeof(psf2_header_t) + 16 + 512 * 4 * FONT_MAX_HEIGHT)
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "  %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return -1;                                                      \
+        }                                                                   \
+    } while (0)
+
+typedef struct {
+    const char* name;
+    int (*run)(void);
+} unit_test_t;
+
+/* Starts the module, with `font` (if any) at NRIO_FONT_PATH */
+static int boot_with_font(const void* font, size_t size) {
+    struct kernel_api* api = mock_kernel_init(TEST_WIDTH, TEST_HEIGHT, 0);
+    if (!api) return -1;
+    if (font && mock_vfs_add_file(NRIO_FONT_PATH, font, size) < 0) return -1;
+    nrio_module_start(api);
+    return 0;
+}
+
+static int boot(void) {
+    return boot_with_font(NULL, 0);
+}
+
+/* Writes text commands to the control device; 0 if all were accepted */
+static int control(const char* text) {
+    size_t len = strlen(text);
+    return mock_dev_write(NRIO_CONTROL_DEVICE, text, len) == (vfs_ssize_t)len ? 0 : -1;
+}
+
+/* Binary batch with one NRIO_OP_NEW record per title */
+static size_t build_new_batch(uint8_t* buf, const char* const* titles, uint16_t count) {
+    nrio_bin_header_t hdr = { NRIO_BIN_MAGIC, NRIO_BIN_VERSION, count };
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    nrio_bin_record_t* rec = (nrio_bin_record_t*)(buf + sizeof(hdr));
+    for (uint16_t i = 0; i < count; i++) {
+        memset(&rec[i], 0, sizeof(rec[i]));
+        rec[i].opcode = NRIO_OP_NEW;
+        strncpy(rec[i].title, titles[i], NRIO_TITLE_MAX - 1);
+    }
+    return sizeof(hdr) + (size_t)count * sizeof(nrio_bin_record_t);
+}
+
+static int test_binary_reserved_bytes(void) {
+    static const char* const titles[] = { "one", "two" };
+    uint8_t buf[sizeof(nrio_bin_header_t) + 2 * sizeof(nrio_bin_record_t)];
+    nrio_bin_record_t* rec = (nrio_bin_record_t*)(buf + sizeof(nrio_bin_header_t));
+    CHECK(boot() == 0);
+
+    size_t size = build_new_batch(buf, titles, 2);
+    CHECK(mock_dev_write(NRIO_CONTROL_DEVICE, buf, size) == (vfs_ssize_t)size);
+    CHECK(active_workspace()->window_count == 2);
+
+    /* Any non-zero reserved byte rejects the whole batch before it is applied */
+    for (uint32_t i = 0; i < sizeof(rec->reserved); i++) {
+        size = build_new_batch(buf, titles, 2);
+        rec[1].reserved[i] = 0x80;
+        CHECK(mock_dev_write(NRIO_CONTROL_DEVICE, buf, size) == -EINVAL);
+        CHECK(active_workspace()->window_count == 2);
+    }
+    return 0;
+}
+
+/* Every workspace record carries its output's index and size */
+static int test_state_outputs(void) {
+    static uint8_t buf[SNAPSHOT_MAX_SIZE];
+    struct kernel_api* api = mock_kernel_init(TEST_WIDTH, TEST_HEIGHT, 0);
+    CHECK(api != NULL);
+    CHECK(mock_kernel_add_output(1024, 768, 0) == 1);
+    nrio_module_start(api);
+    CHECK(control("output 2\n") == 0);
+
+    vfs_ssize_t size = mock_dev_read(NRIO_STATE_DEVICE, buf, sizeof(buf));
+    const nrio_state_header_t* hdr = (const nrio_state_header_t*)buf;
+    CHECK(size >= (vfs_ssize_t)sizeof(*hdr) && (uint32_t)size == hdr->size);
+    CHECK(hdr->magic == NRIO_STATE_MAGIC && hdr->format == NRIO_STATE_FORMAT);
+    CHECK(hdr->output_count == 2 && hdr->active_output == 1);
+
+    const uint8_t* p = buf + sizeof(*hdr);
+    for (uint32_t w = 0; w < hdr->workspace_count; w++) {
+        const nrio_state_workspace_t* rec = (const nrio_state_workspace_t*)p;
+        const output_t* output = workspace_output(&g_workspaces[w]);
+        CHECK(rec->output == (uint32_t)(output - g_outputs));
+        CHECK(rec->output_width == (rec->output ? 1024u : TEST_WIDTH));
+        CHECK(rec->output_height == (rec->output ? 768u : TEST_HEIGHT));
+        CHECK(rec->reserved == 0);
+        p += sizeof(*rec) + rec->window_count * sizeof(nrio_state_window_t);
+    }
+    CHECK(hdr->active_workspace == g_outputs[1].workspace);
+    return 0;
+}
+
+/*
+ * PSF fonts with a diagonal in every glyph: row r of glyph g sets column
+ * (g + r) % width, so each glyph can be told apart and placed. Returns the
+ * file size; extra header bytes test that the header size is honored.
+ */
+static size_t build_psf1(uint8_t* buf, uint8_t char_size, uint8_t mode) {
+    psf1_header_t hdr = { PSF1_MAGIC, mode, char_size };
+    uint32_t glyphs = (mode & PSF1_MODE_512) ? 512 : 256;
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    uint8_t* out = buf + sizeof(hdr);
+    for (uint32_t g = 0; g < glyphs; g++) {
+        for (uint32_t r = 0; r < char_size; r++) *out++ = (uint8_t)(0x80 >> ((g + r) % 8));
+    }
+    return (size_t)(out - buf);
+}
+
+static size_t build_psf2(uint8_t* buf, uint32_t width, uint32_t height, uint32_t glyphs, uint32_t extra) {
+    uint32_t row_bytes = (width + 7) / 8;
+    psf2_header_t hdr = { PSF2_MAGIC, 0, sizeof(psf2_header_t) + extra, 0, glyphs,
+                          row_bytes * height, height, width };
+    memcpy(buf, &hdr, sizeof(hdr));
+    memset(buf + sizeof(hdr), 0xEE, extra);
+
+    uint8_t* out = buf + sizeof(hdr) + extra;
+    for (uint32_t g = 0; g < glyphs; g++) {
+        for (uint32_t r = 0; r < height; r++) {
+            uint32_t col = (g + r) % width;
+            memset(out, 0, row_bytes);
+            out[col / 8] = (uint8_t)(0x80 >> (col % 8));
+            out += row_bytes;
+        }
+    }
+    return (size_t)(out - buf);
+}
+
+/* Every atlas row of every kept glyph has exactly the diagonal's pixel set */
+static int check_font(uint32_t width, uint32_t height) {
+    CHECK(g_font.width == width && g_font.height == height && g_font.atlas);
+    for (uint32_t g = 0; g < FONT_GLYPH_COUNT; g++) {
+        for (uint32_t r = 0; r < height; r++) {
+            const uint32_t* row = &g_font.atlas[(g * height + r) * width];
+            for (uint32_t c = 0; c < width; c++) {
+                CHECK(row[c] == (c == (g + FONT_FIRST_CHAR + r) % width ? 0xFFFFFFFFu : 0));
+            }
+        }
+    }
+    return 0;
+}
+
+static int test_psf1_font(void) {
+    static uint8_t file[TEST_FONT_MAX];
+    size_t size = build_psf1(file, 16, PSF1_MODE_512);
+    CHECK(boot_with_font(file, size) == 0);
+    CHECK(check_font(8, 16) == 0);
+    CHECK(g_bar_height == 16 + BAR_PADDING * 2 || g_bar_height == TOP_BAR_HEIGHT);
+    return 0;
+}
+
+static int test_psf2_font(void) {
+    static uint8_t file[TEST_FONT_MAX];
+    size_t size = build_psf2(file, 12, 20, 128, 5);
+    CHECK(boot_with_font(file, size) == 0);
+    CHECK(check_font(12, 20) == 0);
+    return 0;
+}
+
+/* A rejected file leaves the embedded font in place */
+static int expect_rejected(const uint8_t* file, size_t size) {
+    static uint32_t files = 0;
+    char path[MAX_FILENAME];
+    snprintf(path, sizeof(path), "/bad%u.psf", files++);
+    CHECK(mock_vfs_add_file(path, file, size) == 0);
+    CHECK(font_load_psf(path) < 0);
+    arena_reset(&g_frame_arena);
+    CHECK(g_font.width == 8 && g_font.height == 8);
+    return 0;
+}
+
+static int test_psf_rejects(void) {
+    static uint8_t truncated1[TEST_FONT_MAX], truncated2[TEST_FONT_MAX], short_table[TEST_FONT_MAX];
+    static uint8_t wide[TEST_FONT_MAX], tall[TEST_FONT_MAX], magic[TEST_FONT_MAX];
+    CHECK(boot() == 0);
+
+    /* Headers cut short */
+    build_psf1(truncated1, 16, 0);
+    CHECK(expect_rejected(truncated1, sizeof(psf1_header_t) - 1) == 0);
+    build_psf2(truncated2, 8, 16, 256, 0);
+    CHECK(expect_rejected(truncated2, sizeof(psf2_header_t) - 4) == 0);
+
+    /* Glyph table smaller than length * charsize */
+    size_t size = build_psf2(short_table, 8, 16, 256, 0);
+    CHECK(expect_rejected(short_table, size - (256 - FONT_FIRST_CHAR - FONT_GLYPH_COUNT) * 16 - 1) == 0);
+
+    /* Glyphs larger than the atlas allows */
+    size = build_psf2(wide, FONT_MAX_WIDTH + 1, 16, 128, 0);
+    CHECK(expect_rejected(wide, size) == 0);
+    size = build_psf2(tall, 8, FONT_MAX_HEIGHT + 1, 128, 0);
+    CHECK(expect_rejected(tall, size) == 0);
+
+    size = build_psf2(magic, 8, 16, 128, 0);
+    magic[3] ^= 0x01;
+    CHECK(expect_rejected(magic, size) == 0);
+    return 0;
+}
+
+/* Reads the event stream at `pos` like an open file would; returns records, or -1 */
+static int read_events(vfs_off_t* pos, nrio_event_t* events, uint32_t capacity) {
+    mock_device_t* dev = mock_find_device(NRIO_EVENTS_DEVICE);
+    if (!dev) return -1;
+    vfs_ssize_t n = dev->read(NULL, events, capacity * sizeof(nrio_event_t), pos);
+    if (n < 0 || n % sizeof(nrio_event_t) != 0) return -1;
+    return (int)(n / sizeof(nrio_event_t));
+}
+
+/* Publishes `count` events whose args count up from `first` */
+static void push_events(uint32_t count, int32_t first) {
+    for (uint32_t i = 0; i < count; i++) {
+        event_push(NRIO_EV_RATIO, &g_workspaces[0], 0, first + (int32_t)i);
+    }
+}
+
+/* Checks for consecutive events from sequence number `seq`, with args from `arg` */
+static int check_events(const nrio_event_t* events, uint32_t count, uint64_t seq, int32_t arg) {
+    for (uint32_t i = 0; i < count; i++) {
+        CHECK(events[i].seq == seq + i && events[i].type == NRIO_EV_RATIO);
+        CHECK(events[i].arg == arg + (int32_t)i);
+    }
+    return 0;
+}
+
+/*
+ * Each open file reads from its own position, a buffer smaller than one
+ * record is refused, and a read that spans the end of the ring returns the
+ * events in order.
+ */
+static int test_events_read(void) {
+    static nrio_event_t events[EVENT_RING_SIZE];
+    CHECK(boot() == 0);
+    push_events(EVENT_RING_SIZE / 2 - (uint32_t)(g_event_head & EVENT_RING_MASK), -1000);
+    uint64_t base = g_event_head;
+    vfs_off_t a = (vfs_off_t)base, b = (vfs_off_t)base;
+
+    push_events(3, 0);
+    CHECK(read_events(&a, events, 8) == 3);
+    CHECK(check_events(events, 3, base, 0) == 0);
+    CHECK(read_events(&b, events, 2) == 2);
+    CHECK(check_events(events, 2, base, 0) == 0);
+    CHECK(read_events(&b, events, 8) == 1);
+    CHECK(check_events(events, 1, base + 2, 2) == 0);
+    CHECK(read_events(&a, events, 8) == 0);
+    CHECK(a == (vfs_off_t)(base + 3) && b == a);
+
+    mock_device_t* dev = mock_find_device(NRIO_EVENTS_DEVICE);
+    CHECK(dev->read(NULL, events, sizeof(nrio_event_t) - 1, &a) == -EINVAL);
+    CHECK(a == (vfs_off_t)(base + 3));
+
+    /* Starts mid-ring, so the copy wraps to slot 0 */
+    push_events(EVENT_RING_SIZE - 1, 3);
+    CHECK(read_events(&a, events, EVENT_RING_SIZE) == EVENT_RING_SIZE - 1);
+    CHECK(check_events(events, EVENT_RING_SIZE - 1, base + 3, 3) == 0);
+    CHECK(a == (vfs_off_t)g_event_head);
+    return 0;
+}
+
+/*
+ * A reader lapped by the producer gets an NRIO_EV_OVERRUN record with the
+ * number of events that were overwritten, then the oldest one still held.
+ */
+static int test_events_overrun(void) {
+    static nrio_event_t events[EVENT_RING_SIZE];
+    CHECK(boot() == 0);
+    uint64_t base = g_event_head;
+    vfs_off_t a = (vfs_off_t)base, b = (vfs_off_t)base;
+    uint32_t pushed = EVENT_RING_SIZE + 5;
+    uint32_t dropped = pushed - (EVENT_RING_SIZE - 1);
+
+    push_events(pushed, 0);
+    CHECK(read_events(&a, events, EVENT_RING_SIZE) == EVENT_RING_SIZE);
+    CHECK(events[0].type == NRIO_EV_OVERRUN && events[0].arg == (int32_t)dropped);
+    CHECK(events[0].seq == base + dropped);
+    CHECK(check_events(&events[1], EVENT_RING_SIZE - 1, base + dropped, (int32_t)dropped) == 0);
+    CHECK(a == (vfs_off_t)g_event_head);
+
+    /* Room for the overrun record only: the next read resumes at the oldest event */
+    CHECK(read_events(&b, events, 1) == 1);
+    CHECK(events[0].type == NRIO_EV_OVERRUN && events[0].arg == (int32_t)dropped);
+    CHECK(read_events(&b, events, 1) == 1);
+    CHECK(check_events(events, 1, base + dropped, (int32_t)dropped) == 0);
+    return 0;
+}
+
+/*
+ * Percentiles report the upper bound of the bucket holding the sample at
+ * that rank. Buckets are exact below 4 cycles, split every power of two in
+ * four, and still in range for the largest cycle count.
+ */
+static int test_latency_histogram(void) {
+    static latency_hist_t h;
+    CHECK(latency_percentile(&h, 50) == 0);
+
+    for (uint32_t i = 0; i < 97; i++) latency_add(&h, 10);
+    latency_add(&h, 5000);
+    latency_add(&h, 5000);
+    latency_add(&h, 1000000);
+    CHECK(h.count == 100 && h.min == 10 && h.max == 1000000);
+    CHECK(latency_percentile(&h, 50) == 11);     /* 10 and 11 share a bucket */
+    CHECK(latency_percentile(&h, 99) == 5119);   /* [4096, 5119] */
+    CHECK(latency_percentile(&h, 100) == 1000000);
+
+    CHECK(latency_bucket(0) == 0 && latency_bucket_limit(0) == 0);
+    CHECK(latency_bucket(3) == 3 && latency_bucket(4) == 4 && latency_bucket_limit(4) == 4);
+    for (uint32_t bit = LATENCY_SUB_BITS; bit < 64; bit++) {
+        uint64_t v = 1ull << bit;
+        CHECK(latency_bucket(v - 1) + 1 == latency_bucket(v));
+        CHECK(latency_bucket_limit(latency_bucket(v - 1)) == v - 1);
+    }
+    CHECK(latency_bucket(UINT64_MAX) < LATENCY_BUCKETS);
+    CHECK(latency_bucket(UINT64_MAX) == latency_bucket(UINT64_MAX - (UINT64_MAX >> 3)));
+    CHECK(latency_bucket_limit(latency_bucket(UINT64_MAX)) == UINT64_MAX);
+
+    static latency_hist_t top;
+    latency_add(&top, UINT64_MAX - 1);
+    CHECK(latency_percentile(&top, 50) == UINT64_MAX - 1);
+    return 0;
+}
+
+/* Reads the state device at `pos` to the end; returns the bytes, or -errno */
+static vfs_ssize_t read_state(vfs_off_t* pos, uint8_t* buf, size_t count) {
+    mock_device_t* dev = mock_find_device(NRIO_STATE_DEVICE);
+    size_t total = 0;
+    for (;;) {
+        vfs_ssize_t n = dev->read(NULL, buf + total, count - total < 16 ? count - total : 16, pos);
+        if (n <= 0) return n < 0 ? n : (vfs_ssize_t)total;
+        total += (size_t)n;
+    }
+}
+
+/*
+ * The snapshot is serialized again only after the state version moves. A
+ * read already under way keeps its copy through a batch, and a new read
+ * during the batch is refused rather than given half-updated state.
+ */
+static int test_state_cache(void) {
+    static uint8_t buf[SNAPSHOT_MAX_SIZE];
+    const nrio_state_header_t* hdr = (const nrio_state_header_t*)buf;
+    const nrio_state_workspace_t* ws0 = (const nrio_state_workspace_t*)(buf + sizeof(*hdr));
+    CHECK(boot() == 0);
+    CHECK(control("new a\n") == 0);
+
+    vfs_off_t pos = 0;
+    vfs_ssize_t size = read_state(&pos, buf, sizeof(buf));
+    CHECK(size > 0 && hdr->size == (uint32_t)size && ws0->window_count == 1);
+    uint32_t version = hdr->state_version;
+
+    /* Unchanged state: a new read is served from the cached copy, marker and all */
+    uint8_t marker = (uint8_t)(g_snapshot[size - 1] ^ 0xFF);
+    g_snapshot[size - 1] = marker;
+    pos = 0;
+    CHECK(read_state(&pos, buf, sizeof(buf)) == size);
+    CHECK(buf[size - 1] == marker && g_snapshot_version == version);
+
+    CHECK(control("ratio 60\n") == 0);
+    CHECK(g_state_version != version);
+    pos = 0;
+    CHECK(read_state(&pos, buf, sizeof(buf)) == size);
+    CHECK(buf[size - 1] != marker);
+    CHECK(hdr->state_version == g_state_version && ws0->master_ratio == 60);
+
+    /* Half a snapshot read, then a batch opens another window */
+    mock_device_t* dev = mock_find_device(NRIO_STATE_DEVICE);
+    pos = 0;
+    CHECK(dev->read(NULL, buf, sizeof(*hdr), &pos) == (vfs_ssize_t)sizeof(*hdr));
+    begin_batch();
+    CHECK(control("new b\n") == 0);
+    vfs_ssize_t rest = read_state(&pos, buf + sizeof(*hdr), sizeof(buf) - sizeof(*hdr));
+    CHECK(rest == size - (vfs_ssize_t)sizeof(*hdr));
+    CHECK(hdr->size == (uint32_t)size && ws0->window_count == 1);
+
+    vfs_off_t fresh = 0;
+    CHECK(dev->read(NULL, buf, sizeof(buf), &fresh) == -EBUSY);
+    end_batch();
+    CHECK(read_state(&fresh, buf, sizeof(buf)) == (vfs_ssize_t)hdr->size);
+    CHECK(ws0->window_count == 2 && hdr->state_version == g_state_version);
+    return 0;
+}
+
+#ifdef NRIO_TRACE
+/* Reads the whole trace device from offset 0 in odd-sized pieces; returns its size */
+static size_t read_trace(char* buf, size_t capacity) {
+    mock_device_t* dev = mock_find_device(NRIO_TRACE_DEVICE);
+    vfs_off_t pos = 0;
+    size_t total = 0;
+    for (;;) {
+        size_t want = capacity - total < 1000 ? capacity - total : 1000;
+        vfs_ssize_t n = dev->read(NULL, buf + total, want, &pos);
+        if (n <= 0) return total;
+        total += (size_t)n;
+    }
+}
+
+/*
+ * Checks the structure of a trace dump: brackets and braces balance outside
+ * strings, no comma comes right before a closing one, and begin and end
+ * events nest. Returns the number of events, or -1.
+ */
+static int check_trace_json(const char* json, size_t size) {
+    static const char footer[] = "]}\n";
+    char stack[16];
+    uint32_t depth = 0, in_string = 0, events = 0, open = 0;
+    char last = 0;
+
+    CHECK(size > sizeof(footer) && json[0] == '{');
+    CHECK(memcmp(json + size - (sizeof(footer) - 1), footer, sizeof(footer) - 1) == 0);
+    for (size_t i = 0; i < size; i++) {
+        char c = json[i];
+        if (in_string) {
+            if (c == '"') in_string = 0;
+            continue;
+        }
+        if (c == ' ' || c == '\n') continue;
+        if (c == '"') {
+            in_string = 1;
+        } else if (c == '{' || c == '[') {
+            CHECK(depth < sizeof(stack));
+            stack[depth++] = c;
+        } else if (c == '}' || c == ']') {
+            CHECK(last != ',' && depth > 0 && stack[depth - 1] == (c == '}' ? '{' : '['));
+            depth--;
+        }
+        last = c;
+    }
+    CHECK(depth == 0 && !in_string);
+
+    for (const char* ev = strstr(json, "\"ph\":\""); ev; ev = strstr(ev + 1, "\"ph\":\"")) {
+        if (ev[6] == 'B') {
+            open++;
+        } else {
+            CHECK(ev[6] == 'E' && open > 0);
+            open--;
+        }
+        events++;
+    }
+    return (int)events;
+}
+
+/*
+ * The trace device gives well-formed JSON, also once the ring has wrapped
+ * and its oldest event is an end whose begin was overwritten.
+ */
+static int test_trace_json(void) {
+    static char json[TRACE_HEADER_SIZE + TRACE_RING_SIZE * TRACE_JSON_LINE + TRACE_FOOTER_SIZE + 1];
+    CHECK(boot() == 0);
+    CHECK(control("new a\nnew b\nlayout next\n") == 0);
+    size_t size = read_trace(json, sizeof(json));
+    CHECK(size == TRACE_HEADER_SIZE + g_trace_dump_count * TRACE_JSON_LINE + TRACE_FOOTER_SIZE);
+    CHECK(g_trace_dump_count > 0 && check_trace_json(json, size) == (int)g_trace_dump_count);
+
+    /* One more alternating event than the ring holds: the oldest left is an end */
+    for (uint32_t i = 0; i <= TRACE_RING_SIZE; i++) {
+        trace_event(TRACE_LAYOUT, i & 1 ? 'E' : 'B', i);
+    }
+    CHECK(g_trace_ring[g_trace_head & TRACE_RING_MASK].phase == 'E');
+    size = read_trace(json, sizeof(json));
+    CHECK(g_trace_dump_count == TRACE_RING_SIZE - 1 && g_trace_dump[0].phase == 'B');
+    CHECK(size == TRACE_HEADER_SIZE + g_trace_dump_count * TRACE_JSON_LINE + TRACE_FOOTER_SIZE);
+    CHECK(check_trace_json(json, size) == (int)g_trace_dump_count);
+    return 0;
+}
+#endif
+
+/* Boots on an older kernel's table and checks the module runs on the baseline members alone */
+static int boot_older_kernel(int v0) {
+    static uint8_t file[TEST_FONT_MAX];
+    size_t size = build_psf1(file, 16, 0);
+    CHECK(mock_kernel_init(TEST_WIDTH, TEST_HEIGHT, 0) != NULL);
+    CHECK(mock_vfs_add_file(NRIO_FONT_PATH, file, size) == 0);
+    CHECK(mock_kernel_add_output(320, 200, 0) == 1);
+    struct kernel_api* api = v0 ? mock_kernel_api_v0()
+                                : mock_kernel_api_sized(__builtin_offsetof(struct kernel_api, vfs_open));
+    CHECK(api != NULL);
+    nrio_module_start(api);
+
+    CHECK(g_api->api_magic == KERNEL_API_MAGIC);
+    CHECK(g_output_count == 1 && g_font.width == 8 && g_font.height == 8);
+    CHECK(control("new a\nnew b\n") == 0);
+    CHECK(active_workspace()->window_count == 2);
+    CHECK(mock_fb_pixel(0, 0) != 0 || mock_fb_pixel(TEST_WIDTH / 2, TEST_HEIGHT / 2) != 0);
+    return 0;
+}
+
+/*
+ * A kernel that has api_size but none of the members after the baseline. Its
+ * table ends at an unmapped page, so touching a missing member faults.
+ */
+static int test_api_size(void) {
+    return boot_older_kernel(0);
+}
+
+/* A kernel from before api_magic, whose table is just the baseline members */
+static int test_api_v0(void) {
+    CHECK(boot_older_kernel(1) == 0);
+    CHECK(g_api != NULL && g_api->vfs_open == NULL && g_api->fb_count == NULL);
+    return 0;
+}
+
+/*
+ * Glyph and title caches hold the output's native pixels: after a switch to
+ * rgb565 nothing filled for xrgb8888 is left, and what the redraw filled
+ * again is in the new format.
+ */
+static int test_native_caches(void) {
+    CHECK(boot() == 0);
+    CHECK(control("new a\n") == 0);
+    const title_cache_t* tc = &active_workspace()->windows[0].title_cache;
+    CHECK(tc->valid && tc->format.bpp == 32);
+    CHECK(tc->pixels[0] == COLOR_TITLE_FOCUSED);
+
+    mock_kernel_set_format(mock_fb_format("rgb565"));
+    CHECK(mock_kernel_set_mode(TEST_WIDTH, TEST_HEIGHT, 0) == 0);
+    CHECK(g_outputs[0].native.bpp == 16);
+    CHECK(tc->valid && tc->format.bpp == 16);
+    CHECK(tc->pixels[0] == convert_rgb565(COLOR_TITLE_FOCUSED));
+
+    uint32_t filled = 0;
+    for (uint32_t i = 0; i < GLYPH_CACHE_SLOTS; i++) {
+        const glyph_cache_t* cache = &g_glyph_caches[i];
+        if (!cache->valid) continue;
+        CHECK(cache->format.bpp == 16);
+        uint32_t fg = convert_rgb565(cache->fg), bg = convert_rgb565(cache->bg);
+        for (uint32_t p = 0; p < FONT_GLYPH_COUNT * g_font.width * g_font.height; p++) {
+            CHECK(cache->pixels[p] == fg || cache->pixels[p] == bg);
+        }
+        filled++;
+    }
+    CHECK(filled > 0);
+    CHECK(mock_fb_pixel(0, 0) == (COLOR_BAR_BG & 0xF8FCF8));
+    return 0;
+}
+
+typedef struct {
+    nrio_memory_t totals;
+    nrio_memory_pool_t pools[MEMORY_POOL_COUNT];
+} memory_report_t;
+
+static int read_memory(memory_report_t* report) {
+    vfs_ssize_t n = mock_dev_read(NRIO_MEMORY_DEVICE, report, sizeof(*report));
+    mock_dev_seek(NRIO_MEMORY_DEVICE, 0, VFS_SEEK_SET);
+    CHECK(n == (vfs_ssize_t)sizeof(*report));
+    CHECK(report->totals.pool_count == MEMORY_POOL_COUNT);
+    return 0;
+}
+
+/* Fills the focused window's surface and commits it, like a client frame */
+static int draw_client_frame(uint32_t color) {
+    static uint32_t pixels[TEST_WIDTH * TEST_HEIGHT];
+    uint32_t handle = active_workspace()->windows[active_workspace()->focused_window_index].handle;
+    nrio_surface_info_t info;
+    nrio_damage_t commit = { 0, NRIO_DAMAGE_COMMIT, NULL };
+
+    CHECK(mock_dev_ioctl(NRIO_SURFACE_DEVICE, NRIO_IOC_SELECT_WINDOW, &handle) == 0);
+    CHECK(mock_dev_ioctl(NRIO_SURFACE_DEVICE, NRIO_IOC_SURFACE_INFO, &info) == 0);
+    for (uint32_t i = 0; i < info.width * info.height; i++) pixels[i] = color + i;
+    mock_dev_seek(NRIO_SURFACE_DEVICE, 0, VFS_SEEK_SET);
+    CHECK(mock_dev_write(NRIO_SURFACE_DEVICE, pixels, info.pitch * info.height) ==
+          (vfs_ssize_t)(info.pitch * info.height));
+    CHECK(mock_dev_ioctl(NRIO_SURFACE_DEVICE, NRIO_IOC_DAMAGE, &commit) == 0);
+    return 0;
+}
+
+/* One pass of redraws that ends in the state it started from */
+static int steady_state_cycle(uint32_t pass) {
+    static const char* const commands[] = {
+        "focus next\n", "layout next\n", "ratio 70\n", "titles off\n", "titles on\n",
+        "hide\n", "show\n", "focus prev\n", "ratio 50\n",
+    };
+    for (uint32_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        CHECK(control(commands[i]) == 0);
+        CHECK(draw_client_frame(pass * 0x10101 + i) == 0);
+    }
+    for (uint32_t i = 0; i < LAYOUT_COUNT - 1; i++) {
+        CHECK(control("layout next\n") == 0);
+    }
+    return 0;
+}
+
+/*
+ * Once every window, surface and cache exists, redraws and presents must not
+ * allocate: kmalloc blocks, the byte counts and every pool figure stay put.
+ */
+static int test_steady_state_memory(void) {
+    memory_report_t before, after;
+    CHECK(boot() == 0);
+    CHECK(control("new a\nnew b\nnew c\nhud on\n") == 0);
+
+    /* Warm-up: sizes every surface for every layout and fills the caches */
+    CHECK(steady_state_cycle(0) == 0);
+    CHECK(steady_state_cycle(1) == 0);
+    CHECK(read_memory(&before) == 0);
+    uint32_t live = mock_live_allocations();
+    uint64_t redraws = g_latency[NRIO_LATENCY_REDRAW].count;
+
+    for (uint32_t pass = 2; pass < 6; pass++) CHECK(steady_state_cycle(pass) == 0);
+    CHECK(g_latency[NRIO_LATENCY_REDRAW].count > redraws);
+    CHECK(read_memory(&after) == 0);
+
+    CHECK(mock_live_allocations() == live);
+    CHECK(after.totals.kmem_in_use == before.totals.kmem_in_use);
+    CHECK(after.totals.kmem_peak == before.totals.kmem_peak);
+    CHECK(after.totals.kmem_blocks == before.totals.kmem_blocks);
+    CHECK(after.totals.kmem_blocks == live);
+    for (uint32_t p = 0; p < MEMORY_POOL_COUNT; p++) {
+        const nrio_memory_pool_t* a = &before.pools[p];
+        const nrio_memory_pool_t* b = &after.pools[p];
+        CHECK(strcmp(a->name, b->name) == 0);
+        CHECK(a->used == b->used && a->peak == b->peak && a->chunks == b->chunks);
+        CHECK(b->failures == 0);
+    }
+    CHECK(strcmp(after.pools[0].name, "surface") == 0 && after.pools[0].kind == NRIO_POOL_SLAB);
+    CHECK(strcmp(after.pools[1].name, "frame") == 0 && after.pools[1].kind == NRIO_POOL_ARENA);
+    return 0;
+}
+
+/* Writes one row of the selected surface */
+static int write_surface_row(const nrio_surface_info_t* info, uint32_t y, uint32_t color) {
+    static uint32_t row[TEST_WIDTH];
+    for (uint32_t x = 0; x < info->width; x++) row[x] = color;
+    mock_dev_seek(NRIO_SURFACE_DEVICE, (vfs_off_t)y * info->pitch, VFS_SEEK_SET);
+    CHECK(mock_dev_write(NRIO_SURFACE_DEVICE, row, info->pitch) == (vfs_ssize_t)info->pitch);
+    return 0;
+}
+
+/* Commits the selected surface and returns the screen area that present composited, or 0 */
+static uint64_t commit_surface(void) {
+    nrio_damage_t commit = { 0, NRIO_DAMAGE_COMMIT, NULL };
+    uint64_t presents = g_latency[NRIO_LATENCY_PRESENT].count;
+    if (mock_dev_ioctl(NRIO_SURFACE_DEVICE, NRIO_IOC_DAMAGE, &commit) != 0) return 0;
+    if (g_latency[NRIO_LATENCY_PRESENT].count != presents + 1) return 0;
+    return g_last_frame_damage;
+}
+
+/*
+ * Two commits in one frame present twice, and the second composites only
+ * what was written after the first. Writes before a single commit are
+ * presented together.
+ */
+static int test_commits_per_frame(void) {
+    CHECK(boot() == 0);
+    CHECK(control("new a\n") == 0);
+    uint32_t handle = active_workspace()->windows[0].handle;
+    nrio_surface_info_t info;
+    CHECK(mock_dev_ioctl(NRIO_SURFACE_DEVICE, NRIO_IOC_SELECT_WINDOW, &handle) == 0);
+    CHECK(mock_dev_ioctl(NRIO_SURFACE_DEVICE, NRIO_IOC_SURFACE_INFO, &info) == 0);
+    uint32_t y = info.height / 2;
+
+    CHECK(write_surface_row(&info, y, 0x112233) == 0);
+    uint64_t row = commit_surface();
+    CHECK(row > 0 && row <= info.width);
+    CHECK(write_surface_row(&info, y + 1, 0x445566) == 0);
+    CHECK(commit_surface() == row);
+
+    CHECK(write_surface_row(&info, y + 2, 0x778899) == 0);
+    CHECK(write_surface_row(&info, y + 3, 0xAABBCC) == 0);
+    CHECK(commit_surface() == 2 * row);
+    CHECK(active_workspace()->windows[0].damage_count == 0);
+    return 0;
+}
+
+static const unit_test_t TESTS[] = {
+    { "binary-reserved-bytes", test_binary_reserved_bytes },
+    { "state-outputs", test_state_outputs },
+    { "psf1-font", test_psf1_font },
+    { "psf2-font", test_psf2_font },
+    { "psf-rejects", test_psf_rejects },
+    { "api-size", test_api_size },
+    { "api-v0", test_api_v0 },
+    { "steady-state-memory", test_steady_state_memory },
+    { "commits-per-frame", test_commits_per_frame },
+    { "native-caches", test_native_caches },
+    { "events-read", test_events_read },
+    { "events-overrun", test_events_overrun },
+    { "latency-histogram", test_latency_histogram },
+    { "state-cache", test_state_cache },
+#ifdef NRIO_TRACE
+    { "trace-json", test_trace_json },
+#endif
+};
+
+int main(int argc, char** argv) {
+    const char* only = argc > 1 ? argv[1] : NULL;
+    uint32_t run = 0, failed = 0;
+
+    for (uint32_t i = 0; i < sizeof(TESTS) / sizeof(TESTS[0]); i++) {
+        if (only && strcmp(only, TESTS[i].name) != 0) continue;
+
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 2;
+        }
+        if (pid == 0) _exit(TESTS[i].run() < 0 ? 1 : 0);
+
+        int status;
+        run++;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "%s: FAILED\n", TESTS[i].name);
+            failed++;
+        }
+    }
+
+    printf("%u/%u unit tests passed\n", run - failed, run);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,224 @@
+#ifndef NRIO_H
+#define NRIO_H
+
+#include <stdint.h>
+
+// PSF1/PSF2 font loaded at startup; the built-in 8x8 font is used without it
+#define NRIO_FONT_PATH "/etc/nrio/font.psf"
+
+// Control device
+#define NRIO_CONTROL_DEVICE "/dev/nrio"
+
+// Binary command protocol: a header followed by `count` fixed-size records.
+// A write that starts with NRIO_BIN_MAGIC is parsed as binary, anything else
+// as newline-separated text commands.
+#define NRIO_BIN_MAGIC   0x4F49526E  // "nRIO" in little endian
+#define NRIO_BIN_VERSION 1
+#define NRIO_TITLE_MAX   32
+
+// Opcodes
+#define NRIO_OP_NEW       1  // title: window title
+#define NRIO_OP_CLOSE     2  // handle: window, 0 = focused
+#define NRIO_OP_FOCUS     3  // handle: window, or 0 with arg +1/-1 to cycle
+#define NRIO_OP_LAYOUT    4  // arg: layout index, -1 = next
+#define NRIO_OP_WORKSPACE 5  // arg: workspace index (0-based)
+#define NRIO_OP_RATIO     6  // arg: master ratio in percent
+#define NRIO_OP_HIDE      7  // handle: window, 0 = focused
+#define NRIO_OP_SHOW      8  // handle: window, 0 = most recently hidden
+#define NRIO_OP_TITLE     9  // handle: window, 0 = focused; title: new title
+#define NRIO_OP_TITLES   10  // arg: 1 = draw title strips in frames, 0 = hide
+#define NRIO_OP_HUD      11  // arg: 1 = show the performance HUD, 0 = hide
+#define NRIO_OP_OUTPUT   12  // arg: output index (0-based) to act on
+
+// Layout indices for NRIO_OP_LAYOUT
+#define NRIO_LAYOUT_HORIZONTAL   0
+#define NRIO_LAYOUT_VERTICAL     1
+#define NRIO_LAYOUT_GRID         2
+#define NRIO_LAYOUT_FULLSCREEN   3
+#define NRIO_LAYOUT_MASTER_STACK 4
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+} nrio_bin_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t  opcode;
+    uint8_t  reserved[3];   // must be zero, or the batch is rejected
+    uint32_t handle;
+    int32_t  arg;
+    char     title[NRIO_TITLE_MAX];
+} nrio_bin_record_t;
+
+// Event stream: read() returns whole nrio_event_t records and never blocks.
+// The file position is the reader's next sequence number, so every reader
+// tracks its own progress. Only the newest 255 events can be read; a reader
+// that falls further behind gets an NRIO_EV_OVERRUN record whose arg is the
+// number of events it missed. In mode and output events, workspace is the
+// one shown on that output.
+#define NRIO_EVENTS_DEVICE "/dev/nrio-events"
+
+#define NRIO_EV_WINDOW_NEW      1  // handle: new window, arg: workspace
+#define NRIO_EV_WINDOW_CLOSE    2  // handle: closed window
+#define NRIO_EV_FOCUS           3  // handle: focused window, 0 = none
+#define NRIO_EV_LAYOUT          4  // arg: layout index
+#define NRIO_EV_WORKSPACE       5  // arg: workspace now shown on its output
+#define NRIO_EV_RATIO           6  // arg: master ratio in percent
+#define NRIO_EV_HIDE            7  // handle: window moved to the scratchpad
+#define NRIO_EV_SHOW            8  // handle: window back from the scratchpad
+#define NRIO_EV_OVERRUN         9  // arg: events dropped for this reader
+#define NRIO_EV_SURFACE_RESIZE 10  // handle: window, arg: (w << 16) | h
+#define NRIO_EV_TITLE          11  // handle: window whose title changed
+#define NRIO_EV_MODE           12  // arg: (width << 16) | height of the mode
+#define NRIO_EV_OUTPUT         13  // arg: output index now active
+
+typedef struct {
+    uint64_t seq;
+    uint16_t type;
+    uint16_t workspace;
+    uint32_t handle;
+    int32_t  arg;
+    uint32_t reserved;
+} nrio_event_t;
+
+// Surface device: select a window with NRIO_IOC_SELECT_WINDOW, seek to a byte
+// offset and write 32-bit xRGB8888 pixels, whatever the framebuffer format.
+// Written rows are damaged, and composited at the next commit (see
+// NRIO_IOC_DAMAGE) with format conversion but without any staging copy.
+// Surfaces are cleared whenever the window is resized (see
+// NRIO_EV_SURFACE_RESIZE).
+//
+// The selected window is global, not per open file: pseudo-device callbacks
+// only see the shared device, so a select by one client retargets the writes,
+// seeks and ioctls of every other. Only one client may draw at a time.
+#define NRIO_SURFACE_DEVICE "/dev/nrio-surface"
+
+#define NRIO_IOC_SELECT_WINDOW 0x4E01  // arg: const uint32_t* handle
+#define NRIO_IOC_SURFACE_INFO  0x4E02  // arg: nrio_surface_info_t*
+#define NRIO_IOC_DAMAGE        0x4E03  // arg: const nrio_damage_t*
+
+typedef struct {
+    uint32_t handle;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;   // bytes per row
+    uint32_t bpp;
+} nrio_surface_info_t;
+
+// Damage in surface coordinates. Rects, and the rows touched by writes,
+// accumulate on the window until a commit (count may be 0) or the next
+// redraw presents them; overlapping rects are merged so each pixel is
+// composited once per present. Each commit presents at once, so two commits
+// in one frame are two presents: merge damage by committing once per frame.
+#define NRIO_DAMAGE_MAX_RECTS 64
+#define NRIO_DAMAGE_COMMIT    0x01
+
+typedef struct {
+    uint32_t x, y, width, height;
+} nrio_rect_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t flags;
+    const nrio_rect_t* rects;
+} nrio_damage_t;
+
+// State snapshot: read-only, one nrio_state_header_t, then for each workspace
+// an nrio_state_workspace_t followed by window_count nrio_state_window_t.
+// Each workspace record names the output it belongs to and that output's
+// size; window rects are in that output's coordinates.
+// A read at offset 0 returns a fresh consistent snapshot; read it in one call
+// (header.size bytes) to avoid mixing two snapshots.
+// Format 2 replaced the header's framebuffer size with the output fields.
+#define NRIO_STATE_DEVICE "/dev/nrio-state"
+#define NRIO_STATE_MAGIC  0x54534E52  // "RNST" in little endian
+#define NRIO_STATE_FORMAT 2
+
+#define NRIO_STATE_WIN_HIDDEN  0x01
+#define NRIO_STATE_WIN_FOCUSED 0x02
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t format;
+    uint16_t workspace_count;
+    uint32_t size;             // total snapshot size in bytes
+    uint32_t state_version;    // changes whenever WM state changes
+    uint32_t active_workspace; // shown on the active output
+    uint32_t active_output;    // output that hotkeys and commands act on
+    uint32_t output_count;
+} nrio_state_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t  layout;
+    uint8_t  window_count;
+    uint8_t  visible_count;
+    uint8_t  reserved;         // zero
+    uint32_t focused_handle;
+    uint32_t master_ratio;
+    uint32_t output;           // index of the output the workspace belongs to
+    uint32_t output_width;
+    uint32_t output_height;
+} nrio_state_workspace_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t handle;
+    uint32_t flags;
+    uint32_t x, y, width, height;  // zero for hidden windows
+    char     title[NRIO_TITLE_MAX];
+} nrio_state_window_t;
+
+// Latency device: read-only, one nrio_latency_t per timer in timer order.
+// Times are TSC cycles; p50 and p99 are the upper bounds of log-scale buckets
+// (four per power of two), so they overestimate by at most 25%. A read at
+// offset 0 computes fresh figures.
+#define NRIO_LATENCY_DEVICE "/dev/nrio-latency"
+
+#define NRIO_LATENCY_REDRAW  0  // whole redraw, including its present
+#define NRIO_LATENCY_PRESENT 1  // compositing damaged surface areas
+#define NRIO_LATENCY_TIMERS  2
+
+typedef struct {
+    uint32_t timer;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t last;
+    uint64_t min;
+    uint64_t max;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t total;
+} nrio_latency_t;
+
+// Memory device: read-only, one nrio_memory_t and then pool_count
+// nrio_memory_pool_t, one per slab cache and arena. A read at offset 0 takes
+// fresh figures. Once the windows and their surfaces exist, redraws allocate
+// nothing, so repeating them leaves every figure unchanged.
+#define NRIO_MEMORY_DEVICE "/dev/nrio-memory"
+
+#define NRIO_POOL_SLAB  0
+#define NRIO_POOL_ARENA 1
+
+typedef struct {
+    uint64_t kmem_in_use;      // bytes nRio holds through kmalloc
+    uint64_t kmem_peak;
+    uint32_t kmem_blocks;      // kmalloc blocks not yet freed
+    uint32_t pool_count;
+} nrio_memory_t;
+
+typedef struct {
+    char     name[16];
+    uint32_t kind;             // NRIO_POOL_*
+    uint32_t unit;             // slab: object size; arena: capacity in bytes
+    uint32_t used;             // slab: live objects; arena: bytes in use
+    uint32_t peak;             // most ever used
+    uint32_t chunks;           // slab: chunks taken from kmalloc; arena: 0
+    uint32_t failures;         // allocations that could not be served
+} nrio_memory_pool_t;
+
+// Trace device, only present in builds with NRIO_TRACE: read it from offset 0
+// to get the most recent begin/end events of WM internals as Chrome trace JSON
+// (chrome://tracing, Perfetto). ts is in units of 1000 TSC cycles.
+#define NRIO_TRACE_DEVICE "/dev/nrio-trace"
+
+#endif
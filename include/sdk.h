@@ -1,8 +1,50 @@
 #ifndef KERNEL_API
+#define KERNEL_API
 
 #include <vfs.h>
 
+// Framebuffer pixel layout. Each mask selects a channel within a pixel read
+// as a little-endian integer of bpp bits, so BGR layouts swap the red and
+// blue masks.
+struct fb_format {
+    uint32_t bpp;
+    uint32_t red_mask;
+    uint32_t green_mask;
+    uint32_t blue_mask;
+};
+
+// One framebuffer of a multi-output kernel; pitch is in bytes
+struct fb_info {
+    void* base;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    struct fb_format format;
+};
+
+// The table of kernels built before api_magic existed. Modules get one of
+// these or a struct kernel_api and tell them apart by the first word: here
+// it is kprint, a canonical address, which never equals KERNEL_API_MAGIC.
+struct kernel_api_v0 {
+    void (*kprint)(const char *str, int color);
+    int (*vfs_pseudo_register)(const char* filename, vfs_dev_read_t read_fn, vfs_dev_write_t write_fn, vfs_dev_seek_t seek_fn, vfs_dev_ioctl_t ioctl_fn, void* dev_data);
+    void* (*kmalloc)(size_t size);
+    void (*kfree)(void* ptr);
+    int (*keyboard_register_hotkey)(int scancode, int modifiers, void (*callback)(void*), void* data);
+    void (*keyboard_unregister_hotkey)(int id);
+    void* (*get_framebuffer)(void);
+    void (*get_fb_dimensions)(uint32_t* width, uint32_t* height, uint32_t* pitch);
+    uint32_t (*get_fb_pitch_pixels)(void);
+};
+
+#define KERNEL_API_MAGIC 0x4B41504956455253ull  // "SREVIPAK", not a canonical address
+
 struct kernel_api {
+    // KERNEL_API_MAGIC, and sizeof(struct kernel_api) as the kernel was
+    // built. Both come before the kernel_api_v0 members, so a module reads
+    // no further than a v0 table's first word to tell the two apart.
+    uint64_t api_magic;
+    size_t api_size;
     void (*kprint)(const char *str, int color);
     int (*vfs_pseudo_register)(const char* filename, vfs_dev_read_t read_fn, vfs_dev_write_t write_fn, vfs_dev_seek_t seek_fn, vfs_dev_ioctl_t ioctl_fn, void* dev_data);
     void* (*kmalloc)(size_t size);
@@ -12,5 +54,23 @@ struct kernel_api {
     void* (*get_framebuffer)(void);
     void (*get_fb_dimensions)(uint32_t* width, uint32_t* height, uint32_t* pitch);
     uint32_t (*get_fb_pitch_pixels)(void);
+    // Added later: each member below exists only if api_size covers it, so
+    // check that before the member itself.
+    int (*vfs_open)(const char* filename, int flags);
+    vfs_ssize_t (*vfs_readfd)(int fd, void* buf, size_t count);
+    int (*vfs_close)(int fd);
+    // Optional, may be NULL: fills in the framebuffer format and returns 0.
+    // Without it the framebuffer is 32bpp xRGB8888.
+    int (*get_fb_format)(struct fb_format* format);
+    // Optional, may be NULL: registers a callback run after every mode
+    // change. The framebuffer address, dimensions and format must be read
+    // again; the old framebuffer is no longer valid.
+    int (*fb_register_mode_change)(void (*callback)(void*), void* data);
+    // Optional, may be NULL together: the number of framebuffers, and each
+    // one's address, geometry and format (0 on success). Framebuffer 0 is the
+    // one the calls above describe. The mode change callback covers all of
+    // them. Without these there is a single framebuffer.
+    uint32_t (*fb_count)(void);
+    int (*fb_get_info)(uint32_t index, struct fb_info* info);
 };
 #endif
\ No newline at end of file
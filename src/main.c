@@ -1,4 +1,7 @@
 #include <sdk.h>
+#include <nrio.h>
+
+#include "font8x8.h"
 
 /* Constants */
 #define MAX_WINDOWS_PER_WORKSPACE 6
@@ -7,16 +10,120 @@
 #define DEFAULT_GAP_SIZE 4
 #define DEFAULT_BORDER_SIZE 2
 #define FOCUSED_BORDER_MULTIPLIER 3
-#define SYMBOL_WIDTH 8
-#define SYMBOL_HEIGHT 8
 #define MASTER_RATIO_DEFAULT 50
 #define MASTER_RATIO_MASTER_STACK 60
+#define MASTER_RATIO_MIN 10
+#define MASTER_RATIO_MAX 90
+
+/* Surface pool: class N holds up to (SURFACE_MIN_PIXELS << N) pixels */
+#define SURFACE_CLASS_COUNT 12
+#define SURFACE_MIN_PIXELS (64 * 64)
+#define SURFACE_CLASS_CAPACITY(cls) ((uint32_t)SURFACE_MIN_PIXELS << (cls))
+#define SURFACE_POOL_MAX_FREE 4
+
+/* Damage rects tracked per window before they collapse into one bounding box */
+#define MAX_DAMAGE_RECTS 8
+
+/* Every output shows at least one workspace of its own */
+#define MAX_OUTPUTS WORKSPACE_COUNT
+
+/*
+ * Hosted instrumentation: -DNRIO_OVERDRAW counts writes per framebuffer pixel
+ * for each frame. It compiles to nothing in the module build.
+ */
+#ifdef NRIO_OVERDRAW
+#define OVERDRAW_COUNT(x, y, w, h) overdraw_count(x, y, w, h)
+#define OVERDRAW_BEGIN() overdraw_begin_frame()
+#define OVERDRAW_END() overdraw_end_frame()
+#else
+#define OVERDRAW_COUNT(x, y, w, h) ((void)0)
+#define OVERDRAW_BEGIN() ((void)0)
+#define OVERDRAW_END() ((void)0)
+#endif
+
+/* Performance HUD: right-aligned cells at the end of the top bar */
+#define HUD_CELLS 48
+
+/* Event ring, must be a power of two */
+#define EVENT_RING_SIZE 256
+#define EVENT_RING_MASK (EVENT_RING_SIZE - 1)
+
+/* Latency histograms: values below 4 cycles get exact buckets, then 4 per power of two */
+#define LATENCY_SUB_BITS 2
+#define LATENCY_BUCKETS 256
+
+/*
+ * Trace ring, compiled in with -DNRIO_TRACE. Fills smaller than
+ * TRACE_FILL_MIN_PIXELS are not traced. Each event is dumped as one
+ * fixed-width JSON line so the device can be read at any offset.
+ */
+#define TRACE_RING_SIZE 4096
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+#define TRACE_FILL_MIN_PIXELS 4096
+#define TRACE_JSON_LINE 128
+
+#ifdef NRIO_TRACE
+#define TRACE_BEGIN(name, arg) trace_event(name, 'B', arg)
+#define TRACE_END(name) trace_event(name, 'E', 0)
+#define TRACE_BEGIN_IF(cond, name, arg) do { if (cond) trace_event(name, 'B', arg); } while (0)
+#define TRACE_END_IF(cond, name) do { if (cond) trace_event(name, 'E', 0); } while (0)
+#else
+#define TRACE_BEGIN(name, arg) ((void)0)
+#define TRACE_END(name) ((void)0)
+#define TRACE_BEGIN_IF(cond, name, arg) ((void)0)
+#define TRACE_END_IF(cond, name) ((void)0)
+#endif
+
+/* State snapshot: header plus every workspace with all of its windows */
+#define SNAPSHOT_MAX_SIZE (sizeof(nrio_state_header_t) + \
+    WORKSPACE_COUNT * (sizeof(nrio_state_workspace_t) + \
+                       MAX_WINDOWS_PER_WORKSPACE * sizeof(nrio_state_window_t)))
+#define SNAPSHOT_MAX_RETRIES 64
+
+/* Allocator layer */
+#define KMEM_HEADER_SIZE 16
+#define SLAB_CHUNK_SIZE 4096
+#define SLAB_ALIGN 16
+#define FRAME_ARENA_SIZE (16 * 1024)
+
+/* Fonts: an optional PSF file at NRIO_FONT_PATH, else the embedded 8x8 font */
+#define FONT_FIRST_CHAR 0x20
+#define FONT_GLYPH_COUNT 95
+#define FONT_MAX_WIDTH 32
+#define FONT_MAX_HEIGHT 64
+#define FONT_CHUNK_SIZE 4096
+#define PSF1_MAGIC 0x0436
+#define PSF1_MODE_512 0x01
+#define PSF2_MAGIC 0x864AB572
+
+/* Top bar text; the bar grows to fit taller fonts */
+#define BAR_PADDING 4
+#define BAR_TEXT_X (g_font.width)
+#define BAR_TEXT_Y ((g_bar_height - g_font.height) / 2)
+/*
+ * One rasterized font per color pair. Six pairs are in use: bar text, dimmed
+ * and accented workspace numbers, the empty desktop marker and focused and
+ * unfocused titles. Slots are allocated on first use, so spares cost nothing.
+ */
+#define GLYPH_CACHE_SLOTS 8
+#define BAR_MAX_CELLS 512
+
+/* Window title strips */
+#define TITLE_BAR_HEIGHT (g_font.height + 4)
+#define TITLE_TEXT_X 4
+#define TITLE_TEXT_Y ((TITLE_BAR_HEIGHT - g_font.height) / 2)
 
 /* Colors (ARGB) */
 #define COLOR_BORDER_NORMAL  0x928374
 #define COLOR_WINDOW_BG      0x282828
 #define COLOR_BAR_BG         0x1d2021
 #define COLOR_EMPTY_DESKTOP  0x3c3836
+#define COLOR_BAR_TEXT       0xebdbb2
+#define COLOR_BAR_DIM        0x665c54
+#define COLOR_BAR_ACCENT     0xd79921
+#define COLOR_TITLE_BG       0x3c3836
+#define COLOR_TITLE_TEXT     0xa89984
+#define COLOR_TITLE_FOCUSED  0x504945
 
 /* Layout types */
 typedef enum {
@@ -28,11 +135,193 @@ typedef enum {
     LAYOUT_COUNT
 } layout_type_t;
 
+/* Fixed-size object cache carved out of SLAB_CHUNK_SIZE kernel chunks */
+typedef struct slab_chunk {
+    struct slab_chunk* next;
+} slab_chunk_t;
+
+typedef struct {
+    const char* name;
+    uint32_t object_size;
+    void* free_list;
+    slab_chunk_t* chunks;
+    uint32_t chunk_count;
+    uint32_t live;
+    uint32_t peak;
+    uint32_t failures;
+} slab_cache_t;
+
+/* Bump allocator for per-frame scratch, reset after each present */
+typedef struct {
+    const char* name;
+    uint8_t* base;
+    uint32_t size;
+    uint32_t used;
+    uint32_t peak;
+    uint32_t failures;
+} arena_t;
+
+/* Commands accepted by the control device */
+typedef enum {
+    CMD_NEW,
+    CMD_CLOSE,
+    CMD_FOCUS,
+    CMD_LAYOUT,
+    CMD_WORKSPACE,
+    CMD_RATIO,
+    CMD_HIDE,
+    CMD_SHOW,
+    CMD_TITLE,
+    CMD_TITLES,
+    CMD_HUD,
+    CMD_OUTPUT,
+    CMD_COUNT
+} command_op_t;
+
+typedef struct {
+    command_op_t op;
+    uint32_t handle;         /* 0 targets the focused window */
+    int32_t arg;
+    char title[32];
+} wm_command_t;
+
+/* Framebuffer kernels: dst points at the first pixel, pitch is in bytes */
+typedef void (*fill_kernel_t)(uint8_t* dst, uint32_t pitch, uint32_t width, uint32_t height,
+                              uint32_t native);
+typedef void (*blit_kernel_t)(uint8_t* dst, uint32_t pitch, uint32_t width, uint32_t height,
+                              const uint32_t* src, uint32_t src_pitch);
+
+/* A framebuffer layout with its ARGB conversion and blit kernel */
+typedef struct {
+    const char* name;
+    uint32_t bpp;
+    uint32_t red_mask, green_mask, blue_mask;
+    uint32_t (*convert)(uint32_t color);
+    blit_kernel_t blit;
+} pixel_format_t;
+
+/* Where one channel lands in a native pixel, used by the generic formats */
+typedef struct {
+    uint32_t shift;   /* of the channel's top 8 bits, or fewer */
+    uint32_t drop;    /* low bits of the 8-bit channel that do not fit */
+} pixel_channel_t;
+
+/* Rectangle in surface or screen coordinates */
+typedef struct {
+    uint32_t x, y, width, height;
+} rect_t;
+
+/* Glyph atlas: one all-ones or all-zeros mask word per glyph pixel */
+typedef struct {
+    uint32_t width, height;
+    uint32_t* atlas;         /* FONT_GLYPH_COUNT glyphs of width * height */
+} font_t;
+
+/* On-disk PSF headers */
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t mode;
+    uint8_t char_size;
+} psf1_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t flags;
+    uint32_t glyph_count;
+    uint32_t bytes_per_glyph;
+    uint32_t height;
+    uint32_t width;
+} psf2_header_t;
+
+/* Buffered sequential reader over a VFS file descriptor */
+typedef struct {
+    int fd;
+    uint8_t* buf;
+    uint32_t len, pos;
+} font_reader_t;
+
+/* Font glyphs pre-expanded to native pixels for one fg/bg pair and format */
+typedef struct {
+    uint32_t fg, bg;
+    struct fb_format format;
+    uint32_t* pixels;        /* FONT_GLYPH_COUNT glyphs of g_font.width * g_font.height */
+    uint32_t last_used;
+    uint8_t valid;
+} glyph_cache_t;
+
+/* One character cell of the top bar */
+typedef struct {
+    uint32_t fg, bg;
+    uint8_t ch;
+} bar_cell_t;
+
+/* Off-screen window content in ARGB, converted when composited (pitch == width) */
+typedef struct surface {
+    struct surface* next_free;
+    uint32_t size_class;
+    uint32_t width, height;
+    uint32_t* pixels;
+} surface_t;
+
+/* Rendered title strip in native pixels, reused while its key fields match */
+typedef struct {
+    uint32_t* pixels;
+    uint32_t capacity;       /* in pixels */
+    uint32_t width;
+    struct fb_format format;
+    char title[32];
+    uint8_t focused;
+    uint8_t valid;
+} title_cache_t;
+
+/* Traced sections */
+typedef enum {
+    TRACE_REDRAW,
+    TRACE_LAYOUT,
+    TRACE_FILL,
+    TRACE_FRAME,
+    TRACE_CLEAR_SCREEN,
+    TRACE_CLEAR_STALE,
+    TRACE_PAINT_WINDOWS,
+    TRACE_TOP_BAR,
+    TRACE_PRESENT,
+    TRACE_NAME_COUNT
+} trace_name_t;
+
+/* One begin or end event; arg is only set on begin */
+typedef struct {
+    uint64_t tsc;
+    uint16_t name;
+    uint8_t phase;           /* 'B' or 'E' */
+    uint8_t reserved;
+    uint32_t arg;
+} trace_event_t;
+
+/* Cycle counts of one timed operation */
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t last;
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[LATENCY_BUCKETS];
+} latency_hist_t;
+
 /* Window metadata */
 typedef struct {
     char title[32];
     uint32_t pid;
+    uint32_t handle;
     uint8_t is_open;
+    uint8_t is_hidden;       /* parked in the scratchpad, skipped by layout */
+    uint32_t hidden_seq;     /* scratchpad order, most recent is restored first */
+    surface_t* surface;
+    rect_t damage[MAX_DAMAGE_RECTS];  /* surface areas changed since the last present */
+    uint32_t damage_count;
+    title_cache_t title_cache;
+    uint8_t title_dirty;     /* title changed but the frame did not move */
 } window_t;
 
 /* Layout configuration */
@@ -48,6 +337,7 @@ typedef struct {
 typedef struct {
     uint32_t x, y, width, height;
     uint32_t pid;
+    uint32_t handle;
 } window_position_t;
 
 /* Workspace state */
@@ -56,24 +346,194 @@ typedef struct {
     uint32_t window_count;
     layout_config_t layout;
     uint32_t focused_window_index;
+    uint32_t reported_focus;     /* focused handle last published as an event */
 } workspace_t;
 
+/*
+ * One framebuffer with the workspaces mapped to it. Each output keeps its own
+ * pixel kernels, the previous frame's layout, the top bar as painted and
+ * pending redraw and present flags, so a change on one output never touches
+ * another.
+ */
+typedef struct {
+    uint8_t* framebuffer;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;              /* bytes per row */
+    uint32_t bytes_pp;
+    struct fb_format reported;   /* as the kernel described it, to spot mode changes */
+    struct fb_format native;     /* as drawn: reported, or the xrgb8888 fallback */
+    const pixel_format_t* format;
+    fill_kernel_t fill;
+    blit_kernel_t copy;          /* for sources already in native pixels */
+    pixel_channel_t channels[3]; /* red, green, blue */
+
+    uint32_t first_workspace;    /* workspaces [first, first + count) live here */
+    uint32_t workspace_count;
+    uint32_t workspace;          /* the one shown */
+
+    /* Previous frame for incremental redraw (visible windows only) */
+    window_position_t prev_positions[MAX_WINDOWS_PER_WORKSPACE];
+    uint32_t prev_window_count;
+    uint32_t prev_focused_handle;
+    uint8_t needs_full_redraw;
+    uint8_t redraw_pending;
+    uint8_t present_pending;
+
+    /* Top bar grid as last painted */
+    bar_cell_t bar_cells[BAR_MAX_CELLS];
+    uint8_t bar_valid;
+
+#ifdef NRIO_OVERDRAW
+    /* Writes per pixel during the current (or last finished) frame */
+    uint16_t* overdraw;
+#endif
+} output_t;
+
 /* Global state */
 static struct kernel_api* g_api = NULL;
-static workspace_t g_workspaces[WORKSPACE_COUNT];
-static uint32_t g_active_workspace = 0;
 
-/* Framebuffer info */
-static uint32_t* g_framebuffer = NULL;
-static uint32_t g_fb_width = 0;
-static uint32_t g_fb_height = 0;
-static uint32_t g_fb_pitch_pixels = 0;
+/* A baseline kernel's table, widened to a struct kernel_api */
+static struct kernel_api g_api_v0;
+
+/* A kernel_api member from after the baseline that the kernel both has and set */
+#define API_HAS(member) \
+    (g_api->api_size >= __builtin_offsetof(struct kernel_api, member) + sizeof(g_api->member) && \
+     g_api->member != NULL)
+static workspace_t g_workspaces[WORKSPACE_COUNT];
+static uint32_t g_next_handle = 1;
+static uint32_t g_hide_seq = 0;
+
+/* Command batching: redraws requested inside a batch collapse into one per output */
+static uint32_t g_batch_depth = 0;
+
+/*
+ * Seqlock over WM state: odd while a batch is mutating it. g_state_version
+ * counts actual changes and keys the cached snapshot.
+ */
+static uint32_t g_state_seq = 0;
+static uint32_t g_state_version = 0;
+static uint8_t g_snapshot[SNAPSHOT_MAX_SIZE];
+static uint32_t g_snapshot_size = 0;
+static uint32_t g_snapshot_version = 0;
+static uint8_t g_snapshot_valid = 0;
+
+/*
+ * Window targeted by writes to the surface device. Pseudo-device callbacks get
+ * the device's shared vfs_file_t, never the open handle, so there is nowhere
+ * to keep one per client; nrio.h documents the single-client limit.
+ */
+static uint32_t g_surface_target = 0;
+
+/*
+ * Outputs in kernel framebuffer order. Hotkeys and commands act on the active
+ * output; g_output is the one being drawn.
+ */
+static output_t g_outputs[MAX_OUTPUTS];
+static uint32_t g_output_count = 0;
+static uint32_t g_active_output = 0;
+static output_t* g_output = &g_outputs[0];
+
+/* Framebuffer pixels written since startup, counted once per draw call */
+static uint64_t g_pixels_written = 0;
+
+/*
+ * Frame accounting. Redraws and presents open a frame; a present inside a
+ * redraw joins it. Damage is the screen area repainted, counted without
+ * overlap where the renderer knows it.
+ */
+static uint32_t g_frame_depth = 0;
+static uint64_t g_frame_start_pixels = 0;
+static uint64_t g_frame_damage = 0;
+static uint64_t g_last_frame_pixels = 0;
+static uint64_t g_last_frame_damage = 0;
+
+/* Performance HUD in the top bar */
+static uint8_t g_hud_enabled = 0;
+
+#ifdef NRIO_OVERDRAW
+/* Overdraw statistics of the last finished frame, on whichever output drew it */
+static uint32_t g_overdraw_frames = 0;
+static uint64_t g_overdraw_start = 0;
+static uint64_t g_overdraw_writes = 0;   /* pixel writes in the last frame */
+static uint64_t g_overdraw_unique = 0;   /* distinct pixels written in the last frame */
+static uint32_t g_overdraw_max = 0;      /* most writes to one pixel in the last frame */
+#endif
+
+/* Kernel allocation accounting */
+static size_t g_kmem_in_use = 0;
+static size_t g_kmem_peak = 0;
+static uint32_t g_kmem_live = 0;
+
+/* Object caches and per-frame scratch */
+static slab_cache_t g_surface_slab;
+static uint8_t g_frame_arena_storage[FRAME_ARENA_SIZE] __attribute__((aligned(SLAB_ALIGN)));
+static arena_t g_frame_arena;
+
+/* Memory device report: the totals, then the surface slab and the frame arena */
+#define MEMORY_POOL_COUNT 2
+static struct {
+    nrio_memory_t totals;
+    nrio_memory_pool_t pools[MEMORY_POOL_COUNT];
+} g_memory_report;
+
+/* Active font and the top bar height derived from it */
+static font_t g_font = { 8, 8, NULL };
+static uint32_t g_bar_height = TOP_BAR_HEIGHT;
+
+/* Expanded glyphs for the most recently used color pairs */
+static glyph_cache_t g_glyph_caches[GLYPH_CACHE_SLOTS];
+static uint32_t g_glyph_clock = 0;
+
+/* Scratch for the next frame's top bar grid; the painted grid is per output */
+static bar_cell_t g_bar_next[BAR_MAX_CELLS];
+
+/* Title strips inside window frames */
+static uint8_t g_title_bars = 1;
+
+/* Free surfaces per size class, reused across relayouts */
+static surface_t* g_surface_free[SURFACE_CLASS_COUNT];
+static uint32_t g_surface_free_count[SURFACE_CLASS_COUNT];
+
+/* Single-producer event ring; g_event_head is the next sequence number */
+static nrio_event_t g_event_ring[EVENT_RING_SIZE];
+static uint64_t g_event_head = 0;
+
+/* Redraw and present timings, reported by the latency device */
+static latency_hist_t g_latency[NRIO_LATENCY_TIMERS];
+static nrio_latency_t g_latency_report[NRIO_LATENCY_TIMERS];
+
+#ifdef NRIO_TRACE
+/* Trace ring, and the copy taken when the trace device is read from offset 0 */
+static trace_event_t g_trace_ring[TRACE_RING_SIZE];
+static uint64_t g_trace_head = 0;
+static trace_event_t g_trace_dump[TRACE_RING_SIZE];
+static uint32_t g_trace_dump_count = 0;
+
+static const char TRACE_NAMES[TRACE_NAME_COUNT][16] = {
+    [TRACE_REDRAW] = "redraw",
+    [TRACE_LAYOUT] = "layout",
+    [TRACE_FILL] = "fill_rect",
+    [TRACE_FRAME] = "window_frame",
+    [TRACE_CLEAR_SCREEN] = "clear_screen",
+    [TRACE_CLEAR_STALE] = "clear_stale",
+    [TRACE_PAINT_WINDOWS] = "paint_windows",
+    [TRACE_TOP_BAR] = "top_bar",
+    [TRACE_PRESENT] = "present"
+};
+#endif
+
+/* Layout names used by the control device */
+static const char LAYOUT_NAMES[LAYOUT_COUNT][12] = {
+    [LAYOUT_HORIZONTAL] = "horizontal",
+    [LAYOUT_VERTICAL] = "vertical",
+    [LAYOUT_GRID] = "grid",
+    [LAYOUT_FULLSCREEN] = "fullscreen",
+    [LAYOUT_MASTER_STACK] = "master"
+};
 
-/* Previous state for incremental redraw */
-static window_position_t g_prev_positions[MAX_WINDOWS_PER_WORKSPACE];
-static uint32_t g_prev_window_count = 0;
-static layout_type_t g_prev_layout = LAYOUT_GRID;
-static uint32_t g_prev_focused = 0;
+_Static_assert(NRIO_LAYOUT_MASTER_STACK == LAYOUT_MASTER_STACK && LAYOUT_COUNT == 5,
+               "nrio.h layout indices must match layout_type_t");
 
 /* Predefined layouts */
 static const layout_config_t DEFAULT_LAYOUTS[LAYOUT_COUNT] = {
@@ -115,383 +575,2966 @@ static const layout_config_t DEFAULT_LAYOUTS[LAYOUT_COUNT] = {
 };
 
 /* ------------------------------------------------------------------------- */
-/* Low-level drawing helpers                                                 */
+/* Timestamps and tracing                                                    */
 /* ------------------------------------------------------------------------- */
 
-static void set_pixel(uint32_t x, uint32_t y, uint32_t color) {
-    if (x < g_fb_width && y < g_fb_height) {
-        uint32_t* pixel = &g_framebuffer[y * g_fb_pitch_pixels + x];
-        *pixel = color;
-    }
-}
-
-static void fill_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color) {
-    for (uint32_t dy = 0; dy < height; dy++) {
-        for (uint32_t dx = 0; dx < width; dx++) {
-            set_pixel(x + dx, y + dy, color);
-        }
-    }
+static inline uint64_t read_tsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
 }
 
-static void clear_screen(void) {
-    fill_rect(0, 0, g_fb_width, g_fb_height, COLOR_BAR_BG);
+#ifdef NRIO_TRACE
+/* Appends to the ring, overwriting the oldest event when it is full */
+static void trace_event(trace_name_t name, uint8_t phase, uint32_t arg) {
+    trace_event_t* ev = &g_trace_ring[g_trace_head & TRACE_RING_MASK];
+    ev->tsc = read_tsc();
+    ev->name = (uint16_t)name;
+    ev->phase = phase;
+    ev->reserved = 0;
+    ev->arg = arg;
+    g_trace_head++;
 }
+#endif
 
 /* ------------------------------------------------------------------------- */
-/* String utilities                                                          */
+/* Low-level drawing helpers                                                 */
 /* ------------------------------------------------------------------------- */
 
-static uint32_t string_length(const char* s) {
-    uint32_t len = 0;
-    while (s[len]) len++;
-    return len;
-}
+#ifdef NRIO_OVERDRAW
+static void overdraw_count(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if (!g_output->overdraw) return;
 
-static void string_copy(char* dest, const char* src) {
-    while (*src) *dest++ = *src++;
-    *dest = '\0';
+    for (uint32_t dy = 0; dy < height; dy++) {
+        uint16_t* row = &g_output->overdraw[(y + dy) * g_output->width + x];
+        for (uint32_t dx = 0; dx < width; dx++) {
+            if (row[dx] != 0xFFFF) row[dx]++;
+        }
+    }
 }
 
-/* ------------------------------------------------------------------------- */
-/* Layout calculation functions                                              */
-/* ------------------------------------------------------------------------- */
+/* Called for the outermost frame only, see frame_begin() */
+static void overdraw_begin_frame(void) {
+    if (!g_output->overdraw) return;
 
-static void calculate_horizontal_layout(
-    window_position_t* positions,
-    uint32_t count,
-    uint32_t gap,
-    uint32_t usable_height
-) {
-    uint32_t window_width = (g_fb_width - gap * (count + 1)) / count;
+    uint32_t count = g_output->width * g_output->height;
     for (uint32_t i = 0; i < count; i++) {
-        positions[i].x = gap + i * (window_width + gap);
-        positions[i].y = TOP_BAR_HEIGHT + gap;
-        positions[i].width = window_width;
-        positions[i].height = usable_height - gap;
+        g_output->overdraw[i] = 0;
     }
+    g_overdraw_start = g_pixels_written;
 }
 
-static void calculate_vertical_layout(
-    window_position_t* positions,
-    uint32_t count,
-    uint32_t gap,
-    uint32_t usable_height
-) {
-    uint32_t window_height = (usable_height - gap * (count + 1)) / count;
+static void overdraw_end_frame(void) {
+    const uint16_t* map = g_output->overdraw;
+    if (!map) return;
+
+    uint32_t count = g_output->width * g_output->height;
+    g_overdraw_unique = 0;
+    g_overdraw_max = 0;
     for (uint32_t i = 0; i < count; i++) {
-        positions[i].x = gap;
-        positions[i].y = TOP_BAR_HEIGHT + gap + i * (window_height + gap);
-        positions[i].width = g_fb_width - gap * 2;
-        positions[i].height = window_height;
+        if (map[i]) g_overdraw_unique++;
+        if (map[i] > g_overdraw_max) g_overdraw_max = map[i];
     }
+    g_overdraw_writes = g_pixels_written - g_overdraw_start;
+    g_overdraw_frames++;
 }
+#endif
+
+/*
+ * Pixel format kernels. Everything above the framebuffer works in ARGB; fills
+ * convert their color once per call and blits convert each source pixel with
+ * the constant shifts of the format the kernel was generated for. Layouts not
+ * in PIXEL_FORMATS use the generic kernels, which read the shifts from the
+ * output being drawn instead. Copies take sources that hold one native pixel
+ * per word, like the glyph and title caches, and only store them.
+ */
+#define PIXEL_STORE_2(p, v) (*(uint16_t*)(p) = (uint16_t)(v))
+#define PIXEL_STORE_3(p, v) \
+    ((p)[0] = (uint8_t)(v), (p)[1] = (uint8_t)((v) >> 8), (p)[2] = (uint8_t)((v) >> 16))
+#define PIXEL_STORE_4(p, v) (*(uint32_t*)(p) = (v))
+
+#define DEFINE_FILL_KERNEL(bytes)                                                        \
+    static void fill_kernel_##bytes(uint8_t* dst, uint32_t pitch, uint32_t width,        \
+                                    uint32_t height, uint32_t native) {                  \
+        for (uint32_t dy = 0; dy < height; dy++, dst += pitch) {                         \
+            uint8_t* p = dst;                                                            \
+            for (uint32_t dx = 0; dx < width; dx++, p += (bytes)) {                      \
+                PIXEL_STORE_##bytes(p, native);                                          \
+            }                                                                            \
+        }                                                                                \
+    }
 
-static void calculate_grid_layout(
-    window_position_t* positions,
-    uint32_t count,
-    uint32_t gap,
-    uint32_t usable_height
-) {
-    uint32_t cols = 2;
-    uint32_t rows = (count + 1) / 2;
-    uint32_t cell_width = (g_fb_width - gap * (cols + 1)) / cols;
-    uint32_t cell_height = (usable_height - gap * (rows + 1)) / rows;
-
-    for (uint32_t i = 0; i < count; i++) {
-        uint32_t col = i % cols;
-        uint32_t row = i / cols;
-        positions[i].x = gap + col * (cell_width + gap);
-        positions[i].y = TOP_BAR_HEIGHT + gap + row * (cell_height + gap);
-        positions[i].width = cell_width;
-        positions[i].height = cell_height;
+#define DEFINE_PIXEL_FORMAT(name, bytes, expr)                                           \
+    static uint32_t convert_##name(uint32_t c) {                                         \
+        return (expr);                                                                   \
+    }                                                                                    \
+    static void blit_kernel_##name(uint8_t* dst, uint32_t pitch, uint32_t width,         \
+                                   uint32_t height, const uint32_t* src,                 \
+                                   uint32_t src_pitch) {                                 \
+        for (uint32_t dy = 0; dy < height; dy++, dst += pitch, src += src_pitch) {       \
+            uint8_t* p = dst;                                                            \
+            for (uint32_t dx = 0; dx < width; dx++, p += (bytes)) {                      \
+                uint32_t c = src[dx];                                                    \
+                PIXEL_STORE_##bytes(p, (expr));                                          \
+            }                                                                            \
+        }                                                                                \
     }
-}
 
-static void calculate_fullscreen_layout(
-    window_position_t* positions,
-    uint32_t count,
-    uint32_t gap,
-    uint32_t usable_height
-) {
-    for (uint32_t i = 0; i < count; i++) {
-        positions[i].x = gap;
-        positions[i].y = TOP_BAR_HEIGHT + gap;
-        positions[i].width = g_fb_width - gap * 2;
-        positions[i].height = usable_height - gap;
+#define PIXEL_GENERIC_CHANNEL(c, i) \
+    ((((c) >> (16 - 8 * (i)) & 0xFF) >> g_output->channels[i].drop) << g_output->channels[i].shift)
+#define PIXEL_GENERIC(c) \
+    (PIXEL_GENERIC_CHANNEL(c, 0) | PIXEL_GENERIC_CHANNEL(c, 1) | PIXEL_GENERIC_CHANNEL(c, 2))
+
+#define DEFINE_COPY_KERNEL(bytes)                                                        \
+    static void copy_kernel_##bytes(uint8_t* dst, uint32_t pitch, uint32_t width,        \
+                                    uint32_t height, const uint32_t* src,                \
+                                    uint32_t src_pitch) {                                \
+        for (uint32_t dy = 0; dy < height; dy++, dst += pitch, src += src_pitch) {       \
+            uint8_t* p = dst;                                                            \
+            for (uint32_t dx = 0; dx < width; dx++, p += (bytes)) {                      \
+                PIXEL_STORE_##bytes(p, src[dx]);                                         \
+            }                                                                            \
+        }                                                                                \
     }
-}
 
-static void calculate_master_stack_layout(
-    window_position_t* positions,
-    uint32_t count,
-    uint32_t gap,
-    uint32_t usable_height,
-    uint32_t master_ratio
-) {
-    if (count == 1) {
-        positions[0].x = gap;
-        positions[0].y = TOP_BAR_HEIGHT + gap;
-        positions[0].width = g_fb_width - gap * 2;
-        positions[0].height = usable_height - gap;
-    } else {
-        uint32_t master_width = (g_fb_width * master_ratio / 100) - gap * 2;
-        uint32_t stack_width = g_fb_width - master_width - gap * 3;
+DEFINE_FILL_KERNEL(2)
+DEFINE_FILL_KERNEL(3)
+DEFINE_FILL_KERNEL(4)
+
+DEFINE_COPY_KERNEL(2)
+DEFINE_COPY_KERNEL(3)
+DEFINE_COPY_KERNEL(4)
+
+DEFINE_PIXEL_FORMAT(xrgb8888, 4, c)
+DEFINE_PIXEL_FORMAT(xbgr8888, 4, (c & 0xFF00FF00) | (c >> 16 & 0xFF) | (c & 0xFF) << 16)
+DEFINE_PIXEL_FORMAT(rgb888, 3, c)
+DEFINE_PIXEL_FORMAT(bgr888, 3, (c & 0x00FF00) | (c >> 16 & 0xFF) | (c & 0xFF) << 16)
+DEFINE_PIXEL_FORMAT(rgb565, 2, (c >> 8 & 0xF800) | (c >> 5 & 0x07E0) | (c >> 3 & 0x001F))
+DEFINE_PIXEL_FORMAT(bgr565, 2, (c << 8 & 0xF800) | (c >> 5 & 0x07E0) | (c >> 19 & 0x001F))
+DEFINE_PIXEL_FORMAT(generic16, 2, PIXEL_GENERIC(c))
+DEFINE_PIXEL_FORMAT(generic24, 3, PIXEL_GENERIC(c))
+DEFINE_PIXEL_FORMAT(generic32, 4, PIXEL_GENERIC(c))
+
+static const pixel_format_t PIXEL_FORMATS[] = {
+    { "xrgb8888", 32, 0xFF0000, 0x00FF00, 0x0000FF, convert_xrgb8888, blit_kernel_xrgb8888 },
+    { "xbgr8888", 32, 0x0000FF, 0x00FF00, 0xFF0000, convert_xbgr8888, blit_kernel_xbgr8888 },
+    { "rgb888",   24, 0xFF0000, 0x00FF00, 0x0000FF, convert_rgb888,   blit_kernel_rgb888 },
+    { "bgr888",   24, 0x0000FF, 0x00FF00, 0xFF0000, convert_bgr888,   blit_kernel_bgr888 },
+    { "rgb565",   16, 0xF800,   0x07E0,   0x001F,   convert_rgb565,   blit_kernel_rgb565 },
+    { "bgr565",   16, 0x001F,   0x07E0,   0xF800,   convert_bgr565,   blit_kernel_bgr565 },
+};
 
-        positions[0].x = gap;
-        positions[0].y = TOP_BAR_HEIGHT + gap;
-        positions[0].width = master_width;
-        positions[0].height = usable_height - gap;
+/* Indexed by bytes per pixel minus 2 */
+static const pixel_format_t PIXEL_FORMATS_GENERIC[] = {
+    { "generic16", 16, 0, 0, 0, convert_generic16, blit_kernel_generic16 },
+    { "generic24", 24, 0, 0, 0, convert_generic24, blit_kernel_generic24 },
+    { "generic32", 32, 0, 0, 0, convert_generic32, blit_kernel_generic32 },
+};
 
-        uint32_t stack_count = count - 1;
-        uint32_t stack_height = (usable_height - gap * (stack_count + 1)) / stack_count;
+static const fill_kernel_t FILL_KERNELS[] = { fill_kernel_2, fill_kernel_3, fill_kernel_4 };
+static const blit_kernel_t COPY_KERNELS[] = { copy_kernel_2, copy_kernel_3, copy_kernel_4 };
 
-        for (uint32_t i = 1; i < count; i++) {
-            positions[i].x = master_width + gap * 2;
-            positions[i].y = TOP_BAR_HEIGHT + gap + (i - 1) * (stack_height + gap);
-            positions[i].width = stack_width;
-            positions[i].height = stack_height;
-        }
-    }
+#define PIXEL_FORMAT_COUNT (sizeof(PIXEL_FORMATS) / sizeof(PIXEL_FORMATS[0]))
+
+/* Finds a contiguous channel mask's place in the pixel; returns 0 if it is not one */
+static uint32_t pixel_channel_init(pixel_channel_t* ch, uint32_t mask, uint32_t bpp) {
+    if (mask == 0 || (bpp < 32 && mask >> bpp)) return 0;
+
+    uint32_t low = 0, bits = 0;
+    while (!(mask >> low & 1)) low++;
+    while (low + bits < 32 && (mask >> (low + bits) & 1)) bits++;
+    if (low + bits < 32 && mask >> (low + bits)) return 0;
+
+    ch->shift = bits >= 8 ? low + bits - 8 : low;
+    ch->drop = bits >= 8 ? 0 : 8 - bits;
+    return 1;
 }
 
-static void compute_window_positions(
-    window_position_t* positions,
-    uint32_t count,
-    const layout_config_t* config
-) {
-    uint32_t gap = config->gap_size;
-    uint32_t usable_height = g_fb_height - TOP_BAR_HEIGHT - gap;
+static uint32_t fb_format_equal(const struct fb_format* a, const struct fb_format* b) {
+    return a->bpp == b->bpp && a->red_mask == b->red_mask &&
+           a->green_mask == b->green_mask && a->blue_mask == b->blue_mask;
+}
 
-    for (uint32_t i = 0; i < count; i++) {
-        positions[i].x = 0;
-        positions[i].y = TOP_BAR_HEIGHT;
-        positions[i].width = 0;
-        positions[i].height = 0;
+/*
+ * Picks an output's conversion and kernels for the format the kernel reports.
+ * Runs again after a mode change, which may bring a different format.
+ * Layouts nRio cannot draw fall back to xrgb8888, like a missing call.
+ */
+static void pixel_format_init(output_t* out, const struct fb_format* reported) {
+    struct fb_format fmt = *reported;
+    uint32_t valid = (fmt.bpp == 16 || fmt.bpp == 24 || fmt.bpp == 32) &&
+                     pixel_channel_init(&out->channels[0], fmt.red_mask, fmt.bpp) &&
+                     pixel_channel_init(&out->channels[1], fmt.green_mask, fmt.bpp) &&
+                     pixel_channel_init(&out->channels[2], fmt.blue_mask, fmt.bpp);
+    if (!valid) {
+        fmt.bpp = 32;
+        fmt.red_mask = 0xFF0000;
+        fmt.green_mask = 0x00FF00;
+        fmt.blue_mask = 0x0000FF;
     }
 
-    if (count == 0) return;
-
-    switch (config->type) {
-        case LAYOUT_HORIZONTAL:
-            calculate_horizontal_layout(positions, count, gap, usable_height);
-            break;
-        case LAYOUT_VERTICAL:
-            calculate_vertical_layout(positions, count, gap, usable_height);
-            break;
-        case LAYOUT_GRID:
-            calculate_grid_layout(positions, count, gap, usable_height);
-            break;
-        case LAYOUT_FULLSCREEN:
-            calculate_fullscreen_layout(positions, count, gap, usable_height);
-            break;
-        case LAYOUT_MASTER_STACK:
-            calculate_master_stack_layout(positions, count, gap, usable_height,
-                                          config->master_ratio);
-            break;
-        default:
+    out->native = fmt;
+    out->bytes_pp = fmt.bpp / 8;
+    out->fill = FILL_KERNELS[out->bytes_pp - 2];
+    out->copy = COPY_KERNELS[out->bytes_pp - 2];
+    out->format = &PIXEL_FORMATS_GENERIC[out->bytes_pp - 2];
+    for (uint32_t i = 0; i < PIXEL_FORMAT_COUNT; i++) {
+        const pixel_format_t* pf = &PIXEL_FORMATS[i];
+        if (pf->bpp == fmt.bpp && pf->red_mask == fmt.red_mask &&
+            pf->green_mask == fmt.green_mask && pf->blue_mask == fmt.blue_mask) {
+            out->format = pf;
             break;
+        }
     }
 }
 
-/* ------------------------------------------------------------------------- */
-/* Drawing functions                                                         */
-/* ------------------------------------------------------------------------- */
+static uint8_t* fb_pixel(uint32_t x, uint32_t y) {
+    return &g_output->framebuffer[y * g_output->pitch + x * g_output->bytes_pp];
+}
 
-static void draw_top_bar(void) {
-    fill_rect(0, 0, g_fb_width, TOP_BAR_HEIGHT, COLOR_BAR_BG);
+/* Drawing goes to g_output and is clipped to it */
+static void fill_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color) {
+    output_t* out = g_output;
+    if (x >= out->width || y >= out->height) return;
+    if (width > out->width - x) width = out->width - x;
+    if (height > out->height - y) height = out->height - y;
+    g_pixels_written += (uint64_t)width * height;
+    OVERDRAW_COUNT(x, y, width, height);
+
+    TRACE_BEGIN_IF(width * height >= TRACE_FILL_MIN_PIXELS, TRACE_FILL, width * height);
+    out->fill(fb_pixel(x, y), out->pitch, width, height, out->format->convert(color));
+    TRACE_END_IF(width * height >= TRACE_FILL_MIN_PIXELS, TRACE_FILL);
 }
 
-static void draw_window_frame(
-    const window_position_t* position,
-    uint32_t border_size,
-    uint32_t border_color,
-    uint32_t is_focused
+static void blit_rect(
+    uint32_t x,
+    uint32_t y,
+    uint32_t width,
+    uint32_t height,
+    const uint32_t* src,
+    uint32_t src_pitch
 ) {
-    uint32_t x = position->x;
-    uint32_t y = position->y;
-    uint32_t w = position->width;
-    uint32_t h = position->height;
-    uint32_t border = is_focused ? border_size * FOCUSED_BORDER_MULTIPLIER : border_size;
-
-    fill_rect(x + border, y + border, w - border * 2, h - border * 2, COLOR_WINDOW_BG);
-    fill_rect(x, y, w, border, border_color);
-    fill_rect(x, y + h - border, w, border, border_color);
-    fill_rect(x, y, border, h, border_color);
-    fill_rect(x + w - border, y, border, h, border_color);
+    output_t* out = g_output;
+    if (x >= out->width || y >= out->height) return;
+    if (width > out->width - x) width = out->width - x;
+    if (height > out->height - y) height = out->height - y;
+    g_pixels_written += (uint64_t)width * height;
+    OVERDRAW_COUNT(x, y, width, height);
+
+    out->format->blit(fb_pixel(x, y), out->pitch, width, height, src, src_pitch);
 }
 
-static void draw_empty_desktop_indicator(void) {
-    const char* text = "~";
-    uint32_t text_width = string_length(text) * SYMBOL_WIDTH;
-    uint32_t x = (g_fb_width - text_width) / 2;
-    uint32_t y = g_fb_height / 2 - SYMBOL_HEIGHT / 2;
+/* Like blit_rect, for a source already in g_output's native format */
+static void blit_native_rect(
+    uint32_t x,
+    uint32_t y,
+    uint32_t width,
+    uint32_t height,
+    const uint32_t* src,
+    uint32_t src_pitch
+) {
+    output_t* out = g_output;
+    if (x >= out->width || y >= out->height) return;
+    if (width > out->width - x) width = out->width - x;
+    if (height > out->height - y) height = out->height - y;
+    g_pixels_written += (uint64_t)width * height;
+    OVERDRAW_COUNT(x, y, width, height);
+
+    out->copy(fb_pixel(x, y), out->pitch, width, height, src, src_pitch);
+}
 
-    for (uint32_t i = 0; i < string_length(text); i++) {
-        fill_rect(x + i * SYMBOL_WIDTH, y, SYMBOL_WIDTH, SYMBOL_HEIGHT, COLOR_EMPTY_DESKTOP);
-    }
+static void clear_screen(void) {
+    TRACE_BEGIN(TRACE_CLEAR_SCREEN, 0);
+    fill_rect(0, 0, g_output->width, g_output->height, COLOR_BAR_BG);
+    TRACE_END(TRACE_CLEAR_SCREEN);
 }
 
-static void redraw_incremental(void) {
-    workspace_t* ws = &g_workspaces[g_active_workspace];
+/* ------------------------------------------------------------------------- */
+/* String utilities                                                          */
+/* ------------------------------------------------------------------------- */
+
+static uint32_t string_length(const char* s) {
+    uint32_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
 
-    if (ws->window_count != g_prev_window_count || ws->layout.type != g_prev_layout) {
+static void string_copy(char* dest, const char* src) {
+    while (*src) *dest++ = *src++;
+    *dest = '\0';
+}
 
-        for (uint32_t i = 0; i < g_prev_window_count; i++) {
-            fill_rect(g_prev_positions[i].x, g_prev_positions[i].y,
-                     g_prev_positions[i].width, g_prev_positions[i].height,
-                     COLOR_BAR_BG);
-        }
-        
-        if (ws->window_count == 0) {
-            draw_empty_desktop_indicator();
-        } else {
-            window_position_t positions[MAX_WINDOWS_PER_WORKSPACE];
-            compute_window_positions(positions, ws->window_count, &ws->layout);
-            
-            for (uint32_t i = 0; i < ws->window_count; i++) {
-                positions[i].pid = ws->windows[i].pid;
-                draw_window_frame(&positions[i], ws->layout.border_size,
-                                ws->layout.border_color,
-                                i == ws->focused_window_index);
-                g_prev_positions[i] = positions[i];
-            }
-        }
-        
-        g_prev_window_count = ws->window_count;
-        g_prev_layout = ws->layout.type;
-        g_prev_focused = ws->focused_window_index;
+static uint32_t string_equal(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
     }
+    return *a == *b;
+}
 
-    else if (ws->focused_window_index != g_prev_focused) {
-        window_position_t positions[MAX_WINDOWS_PER_WORKSPACE];
-        compute_window_positions(positions, ws->window_count, &ws->layout);
+static void memory_copy(void* dest, const void* src, size_t count) {
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+    while (count--) *d++ = *s++;
+}
+
+/* Unterminated string builders: each returns the position after what it wrote */
+static char* put_str(char* out, const char* s) {
+    while (*s) *out++ = *s++;
+    return out;
+}
 
-        draw_window_frame(&positions[g_prev_focused], ws->layout.border_size,
-                         ws->layout.border_color, 0);
+static char* put_u64(char* out, uint64_t value, uint32_t min_digits) {
+    char digits[20];
+    uint32_t n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value || n < min_digits);
+    while (n) *out++ = digits[--n];
+    return out;
+}
 
-        draw_window_frame(&positions[ws->focused_window_index], ws->layout.border_size,
-                         ws->layout.border_color, 1);
+/* At most four characters plus a k/M/G/T suffix, e.g. 950, 1.2k, 37M */
+static char* put_si(char* out, uint64_t value) {
+    static const char SUFFIXES[] = "kMGT";
+    uint64_t div = 1;
+    uint32_t unit = 0;
 
-        g_prev_focused = ws->focused_window_index;
+    if (value < 1000) return put_u64(out, value, 1);
+    while (unit < 4 && value / div >= 1000) {
+        div *= 1000;
+        unit++;
     }
+    uint64_t whole = value / div;
+    out = put_u64(out, whole, 1);
+    if (whole < 10) {
+        *out++ = '.';
+        out = put_u64(out, (value % div) * 10 / div, 1);
+    }
+    *out++ = SUFFIXES[unit - 1];
+    return out;
 }
 
 /* ------------------------------------------------------------------------- */
-/* Workspace and window management                                           */
+/* Memory management                                                         */
 /* ------------------------------------------------------------------------- */
 
-static void initialize_workspaces(void) {
-    for (uint32_t i = 0; i < WORKSPACE_COUNT; i++) {
-        workspace_t* ws = &g_workspaces[i];
-        ws->window_count = 0;
-        ws->layout = DEFAULT_LAYOUTS[LAYOUT_GRID];
-        ws->focused_window_index = 0;
-        for (uint32_t j = 0; j < MAX_WINDOWS_PER_WORKSPACE; j++) {
-            ws->windows[j].is_open = 0;
-            ws->windows[j].title[0] = '\0';
-        }
-    }
+/* kmalloc wrapper that remembers the block size so usage can be tracked */
+static void* kmem_alloc(size_t size) {
+    uint8_t* block = g_api->kmalloc(size + KMEM_HEADER_SIZE);
+    if (!block) return NULL;
+
+    *(size_t*)block = size;
+    g_kmem_in_use += size;
+    g_kmem_live++;
+    if (g_kmem_in_use > g_kmem_peak) g_kmem_peak = g_kmem_in_use;
+    return block + KMEM_HEADER_SIZE;
 }
 
-static void add_window_to_current_workspace(const char* title) {
-    workspace_t* ws = &g_workspaces[g_active_workspace];
-    if (ws->window_count >= MAX_WINDOWS_PER_WORKSPACE) return;
+static void kmem_free(void* ptr) {
+    if (!ptr) return;
 
-    window_t* win = &ws->windows[ws->window_count];
-    string_copy(win->title, title);
-    win->is_open = 1;
-    win->pid = ws->window_count;
-    ws->window_count++;
-    ws->focused_window_index = ws->window_count - 1;
-    redraw_incremental();
+    uint8_t* block = (uint8_t*)ptr - KMEM_HEADER_SIZE;
+    g_kmem_in_use -= *(size_t*)block;
+    g_kmem_live--;
+    g_api->kfree(block);
 }
 
-static void close_current_window(void) {
-    workspace_t* ws = &g_workspaces[g_active_workspace];
-    if (ws->window_count == 0) return;
+static void slab_init(slab_cache_t* cache, const char* name, uint32_t object_size) {
+    if (object_size < sizeof(void*)) object_size = sizeof(void*);
+    cache->name = name;
+    cache->object_size = (object_size + SLAB_ALIGN - 1) & ~(uint32_t)(SLAB_ALIGN - 1);
+    cache->free_list = NULL;
+    cache->chunks = NULL;
+    cache->chunk_count = 0;
+    cache->live = 0;
+    cache->peak = 0;
+    cache->failures = 0;
+}
 
-    uint32_t focused = ws->focused_window_index;
-    for (uint32_t i = focused; i < ws->window_count - 1; i++) {
-        ws->windows[i] = ws->windows[i + 1];
+static int slab_grow(slab_cache_t* cache) {
+    slab_chunk_t* chunk = kmem_alloc(SLAB_CHUNK_SIZE);
+    if (!chunk) return 0;
+
+    chunk->next = cache->chunks;
+    cache->chunks = chunk;
+    cache->chunk_count++;
+
+    uint8_t* obj = (uint8_t*)chunk + SLAB_ALIGN;
+    uint8_t* end = (uint8_t*)chunk + SLAB_CHUNK_SIZE;
+    for (; obj + cache->object_size <= end; obj += cache->object_size) {
+        *(void**)obj = cache->free_list;
+        cache->free_list = obj;
     }
+    return 1;
+}
 
-    ws->window_count--;
-    if (ws->window_count == 0) {
-        ws->focused_window_index = 0;
-    } else if (focused >= ws->window_count) {
-        ws->focused_window_index = ws->window_count - 1;
+static void* slab_alloc(slab_cache_t* cache) {
+    if (!cache->free_list && !slab_grow(cache)) {
+        cache->failures++;
+        return NULL;
     }
 
-    redraw_incremental();
+    void* obj = cache->free_list;
+    cache->free_list = *(void**)obj;
+    cache->live++;
+    if (cache->live > cache->peak) cache->peak = cache->live;
+    return obj;
 }
 
-static void cycle_focus(int direction) {
-    workspace_t* ws = &g_workspaces[g_active_workspace];
-    if (ws->window_count == 0) return;
+static void slab_free(slab_cache_t* cache, void* obj) {
+    if (!obj) return;
+    *(void**)obj = cache->free_list;
+    cache->free_list = obj;
+    cache->live--;
+}
 
-    if (direction > 0) {
-        ws->focused_window_index = (ws->focused_window_index + 1) % ws->window_count;
-    } else {
-        ws->focused_window_index = (ws->focused_window_index + ws->window_count - 1) % ws->window_count;
+static void arena_init(arena_t* arena, const char* name, uint8_t* base, uint32_t size) {
+    arena->name = name;
+    arena->base = base;
+    arena->size = size;
+    arena->used = 0;
+    arena->peak = 0;
+    arena->failures = 0;
+}
+
+static void* arena_alloc(arena_t* arena, uint32_t size) {
+    uint32_t offset = (arena->used + SLAB_ALIGN - 1) & ~(uint32_t)(SLAB_ALIGN - 1);
+    if (offset > arena->size || size > arena->size - offset) {
+        arena->failures++;
+        return NULL;
     }
-    redraw_incremental();
+
+    arena->used = offset + size;
+    if (arena->used > arena->peak) arena->peak = arena->used;
+    return arena->base + offset;
 }
 
-static void cycle_layout(void) {
-    workspace_t* ws = &g_workspaces[g_active_workspace];
-    layout_type_t current = ws->layout.type;
-    layout_type_t next = (current + 1) % LAYOUT_COUNT;
-    ws->layout = DEFAULT_LAYOUTS[next];
-    redraw_incremental();
+static void arena_reset(arena_t* arena) {
+    arena->used = 0;
 }
 
-/* ------------------------------------------------------------------------- */
-/* Keyboard callbacks                                                        */
-/* ------------------------------------------------------------------------- */
+static void memory_pool_name(nrio_memory_pool_t* rec, const char* name) {
+    uint32_t i = 0;
+    for (; name[i] && i < sizeof(rec->name) - 1; i++) rec->name[i] = name[i];
+    for (; i < sizeof(rec->name); i++) rec->name[i] = '\0';
+}
+
+static void memory_fill_report(void) {
+    nrio_memory_t* totals = &g_memory_report.totals;
+    totals->kmem_in_use = g_kmem_in_use;
+    totals->kmem_peak = g_kmem_peak;
+    totals->kmem_blocks = g_kmem_live;
+    totals->pool_count = MEMORY_POOL_COUNT;
+
+    nrio_memory_pool_t* slab = &g_memory_report.pools[0];
+    memory_pool_name(slab, g_surface_slab.name);
+    slab->kind = NRIO_POOL_SLAB;
+    slab->unit = g_surface_slab.object_size;
+    slab->used = g_surface_slab.live;
+    slab->peak = g_surface_slab.peak;
+    slab->chunks = g_surface_slab.chunk_count;
+    slab->failures = g_surface_slab.failures;
+
+    nrio_memory_pool_t* arena = &g_memory_report.pools[1];
+    memory_pool_name(arena, g_frame_arena.name);
+    arena->kind = NRIO_POOL_ARENA;
+    arena->unit = g_frame_arena.size;
+    arena->used = g_frame_arena.used;
+    arena->peak = g_frame_arena.peak;
+    arena->chunks = 0;
+    arena->failures = g_frame_arena.failures;
+}
+
+/* A read at offset 0 takes fresh figures; later offsets continue that copy */
+static vfs_ssize_t memory_read(vfs_file_t* file, void* buf, size_t count, vfs_off_t* pos) {
+    (void)file;
+    if (*pos < 0) return -EINVAL;
+    if (*pos == 0) memory_fill_report();
+    if ((size_t)*pos >= sizeof(g_memory_report)) return 0;
+
+    size_t n = sizeof(g_memory_report) - (size_t)*pos;
+    if (n > count) n = count;
+    memory_copy(buf, (const uint8_t*)&g_memory_report + *pos, n);
+    *pos += (vfs_off_t)n;
+    return (vfs_ssize_t)n;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Surface pool                                                              */
+/* ------------------------------------------------------------------------- */
+
+static uint32_t surface_class_for(uint32_t pixels) {
+    uint32_t cls = 0;
+    while (cls < SURFACE_CLASS_COUNT && SURFACE_CLASS_CAPACITY(cls) < pixels) cls++;
+    return cls;
+}
+
+static surface_t* surface_acquire(uint32_t width, uint32_t height) {
+    uint32_t cls = surface_class_for(width * height);
+    if (cls >= SURFACE_CLASS_COUNT) return NULL;
+
+    surface_t* s = g_surface_free[cls];
+    if (s) {
+        g_surface_free[cls] = s->next_free;
+        g_surface_free_count[cls]--;
+    } else {
+        s = slab_alloc(&g_surface_slab);
+        if (!s) return NULL;
+        s->pixels = kmem_alloc(SURFACE_CLASS_CAPACITY(cls) * sizeof(uint32_t));
+        if (!s->pixels) {
+            slab_free(&g_surface_slab, s);
+            return NULL;
+        }
+        s->size_class = cls;
+    }
+
+    s->next_free = NULL;
+    s->width = width;
+    s->height = height;
+    return s;
+}
+
+static void surface_release(surface_t* s) {
+    if (!s) return;
+
+    uint32_t cls = s->size_class;
+    if (g_surface_free_count[cls] >= SURFACE_POOL_MAX_FREE) {
+        kmem_free(s->pixels);
+        slab_free(&g_surface_slab, s);
+        return;
+    }
+    s->next_free = g_surface_free[cls];
+    g_surface_free[cls] = s;
+    g_surface_free_count[cls]++;
+}
+
+static void surface_clear(surface_t* s, uint32_t color) {
+    uint32_t count = s->width * s->height;
+    for (uint32_t i = 0; i < count; i++) {
+        s->pixels[i] = color;
+    }
+}
+
+/* Resizes a window's surface, keeping the buffer while the size class matches */
+static void window_fit_surface(window_t* win, uint32_t width, uint32_t height) {
+    surface_t* s = win->surface;
+    if (s && s->width == width && s->height == height) return;
+
+    if (width == 0 || height == 0) {
+        surface_release(s);
+        win->surface = NULL;
+        return;
+    }
+
+    if (s && surface_class_for(width * height) == s->size_class) {
+        s->width = width;
+        s->height = height;
+    } else {
+        surface_release(s);
+        s = surface_acquire(width, height);
+        win->surface = s;
+        if (!s) return;
+    }
+
+    surface_clear(s, COLOR_WINDOW_BG);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Font loading                                                              */
+/* ------------------------------------------------------------------------- */
+
+static uint32_t* font_alloc_atlas(uint32_t width, uint32_t height) {
+    return kmem_alloc(FONT_GLYPH_COUNT * width * height * sizeof(uint32_t));
+}
+
+/* Converts one bitmap row to mask words; PSF rows are MSB-first, font8x8 LSB-first */
+static void font_put_row(font_t* font, uint32_t glyph, uint32_t row,
+                         const uint8_t* bits, uint32_t msb_first) {
+    uint32_t* out = &font->atlas[(glyph * font->height + row) * font->width];
+    for (uint32_t col = 0; col < font->width; col++) {
+        uint32_t shift = msb_first ? 7 - (col & 7) : (col & 7);
+        out[col] = 0u - ((bits[col >> 3] >> shift) & 1u);
+    }
+}
+
+static void font_load_embedded(void) {
+    g_font.width = 8;
+    g_font.height = 8;
+    g_font.atlas = font_alloc_atlas(8, 8);
+    if (!g_font.atlas) return;
+
+    for (uint32_t g = 0; g < FONT_GLYPH_COUNT; g++) {
+        for (uint32_t row = 0; row < 8; row++) {
+            font_put_row(&g_font, g, row, &FONT8X8_BASIC[g][row], 0);
+        }
+    }
+}
+
+/* Copies the next count bytes of the file, refilling the chunk buffer as needed */
+static uint32_t font_read(font_reader_t* reader, void* dest, uint32_t count) {
+    uint8_t* out = dest;
+    while (count > 0) {
+        if (reader->pos == reader->len) {
+            vfs_ssize_t n = g_api->vfs_readfd(reader->fd, reader->buf, FONT_CHUNK_SIZE);
+            if (n <= 0) return 0;
+            reader->len = (uint32_t)n;
+            reader->pos = 0;
+        }
+        uint32_t n = reader->len - reader->pos;
+        if (n > count) n = count;
+        if (out) {
+            memory_copy(out, &reader->buf[reader->pos], n);
+            out += n;
+        }
+        reader->pos += n;
+        count -= n;
+    }
+    return 1;
+}
+
+/*
+ * Streams a PSF1 or PSF2 file and keeps only the printable ASCII glyphs. PSF
+ * glyph order is assumed to follow ASCII for those codes; Unicode tables are
+ * not consulted.
+ */
+static int font_load_psf(const char* path) {
+    if (!API_HAS(vfs_open) || !API_HAS(vfs_readfd) || !API_HAS(vfs_close)) return -1;
+
+    font_reader_t reader = { 0, NULL, 0, 0 };
+    reader.buf = arena_alloc(&g_frame_arena, FONT_CHUNK_SIZE);
+    if (!reader.buf) return -1;
+    reader.fd = g_api->vfs_open(path, VFS_READ);
+    if (reader.fd < 0) return -1;
+
+    font_t font = { 0, 0, NULL };
+    uint32_t glyph_count, bytes_per_glyph, header_size;
+    psf2_header_t hdr;
+    int result = -1;
+
+    if (!font_read(&reader, &hdr, sizeof(psf1_header_t))) goto out;
+    const psf1_header_t* psf1 = (const psf1_header_t*)&hdr;
+    if (psf1->magic == PSF1_MAGIC) {
+        font.width = 8;
+        font.height = psf1->char_size;
+        glyph_count = (psf1->mode & PSF1_MODE_512) ? 512 : 256;
+        bytes_per_glyph = psf1->char_size;
+        header_size = sizeof(psf1_header_t);
+    } else if (hdr.magic == PSF2_MAGIC) {
+        if (!font_read(&reader, (uint8_t*)&hdr + sizeof(psf1_header_t),
+                       sizeof(hdr) - sizeof(psf1_header_t))) goto out;
+        font.width = hdr.width;
+        font.height = hdr.height;
+        glyph_count = hdr.glyph_count;
+        bytes_per_glyph = hdr.bytes_per_glyph;
+        header_size = hdr.header_size;
+        if (header_size < sizeof(hdr)) goto out;
+    } else {
+        goto out;
+    }
+
+    uint32_t row_bytes = (font.width + 7) / 8;
+    if (font.width == 0 || font.width > FONT_MAX_WIDTH ||
+        font.height == 0 || font.height > FONT_MAX_HEIGHT ||
+        bytes_per_glyph != row_bytes * font.height ||
+        glyph_count < FONT_FIRST_CHAR + FONT_GLYPH_COUNT) {
+        goto out;
+    }
+
+    /* Skip the rest of the header and the control-character glyphs */
+    uint32_t consumed = psf1->magic == PSF1_MAGIC ? sizeof(psf1_header_t) : sizeof(hdr);
+    if (!font_read(&reader, NULL, header_size - consumed + FONT_FIRST_CHAR * bytes_per_glyph)) goto out;
+
+    font.atlas = font_alloc_atlas(font.width, font.height);
+    if (!font.atlas) goto out;
+
+    uint8_t row[FONT_MAX_WIDTH / 8];
+    for (uint32_t g = 0; g < FONT_GLYPH_COUNT; g++) {
+        for (uint32_t r = 0; r < font.height; r++) {
+            if (!font_read(&reader, row, row_bytes)) {
+                kmem_free(font.atlas);
+                goto out;
+            }
+            font_put_row(&font, g, r, row, 1);
+        }
+    }
+
+    g_font = font;
+    result = 0;
+out:
+    g_api->vfs_close(reader.fd);
+    return result;
+}
+
+/* Builds the glyph atlas once at startup and sizes the top bar to the font */
+static void font_init(void) {
+    if (font_load_psf(NRIO_FONT_PATH) < 0) font_load_embedded();
+    arena_reset(&g_frame_arena);
+
+    g_bar_height = g_font.height + BAR_PADDING * 2;
+    if (g_bar_height < TOP_BAR_HEIGHT) g_bar_height = TOP_BAR_HEIGHT;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Text rendering                                                            */
+/* ------------------------------------------------------------------------- */
+
+/* Expands every glyph for the slot's colors from the mask atlas, in g_output's format */
+static void glyph_cache_fill(glyph_cache_t* cache) {
+    uint32_t count = FONT_GLYPH_COUNT * g_font.width * g_font.height;
+    uint32_t bg = g_output->format->convert(cache->bg);
+    uint32_t diff = g_output->format->convert(cache->fg) ^ bg;
+    for (uint32_t i = 0; i < count; i++) {
+        cache->pixels[i] = bg ^ (diff & g_font.atlas[i]);
+    }
+}
+
+/* Returns the cache for a color pair on g_output, recycling the oldest slot */
+static glyph_cache_t* glyph_cache_get(uint32_t fg, uint32_t bg) {
+    glyph_cache_t* victim = &g_glyph_caches[0];
+    if (!g_font.atlas) return NULL;
+    g_glyph_clock++;
+
+    for (uint32_t i = 0; i < GLYPH_CACHE_SLOTS; i++) {
+        glyph_cache_t* cache = &g_glyph_caches[i];
+        if (cache->valid && cache->fg == fg && cache->bg == bg &&
+            fb_format_equal(&cache->format, &g_output->native)) {
+            cache->last_used = g_glyph_clock;
+            return cache;
+        }
+        if (!cache->valid || cache->last_used < victim->last_used) victim = cache;
+    }
+
+    if (!victim->pixels) {
+        victim->pixels = kmem_alloc(FONT_GLYPH_COUNT * g_font.width * g_font.height * sizeof(uint32_t));
+        if (!victim->pixels) return NULL;
+    }
+    victim->fg = fg;
+    victim->bg = bg;
+    victim->format = g_output->native;
+    victim->last_used = g_glyph_clock;
+    victim->valid = 1;
+    glyph_cache_fill(victim);
+    return victim;
+}
+
+static void draw_glyph(uint32_t x, uint32_t y, uint8_t ch, const glyph_cache_t* cache, uint32_t bg) {
+    uint32_t c = ch;
+    if (c < FONT_FIRST_CHAR || c >= FONT_FIRST_CHAR + FONT_GLYPH_COUNT) c = '?';
+    if (!cache) {
+        fill_rect(x, y, g_font.width, g_font.height, bg);
+        return;
+    }
+    blit_native_rect(x, y, g_font.width, g_font.height,
+                     &cache->pixels[(c - FONT_FIRST_CHAR) * g_font.width * g_font.height], g_font.width);
+}
+
+/* Renders text into an off-screen buffer of native pixels, clipped to width x height */
+static void render_text(uint32_t* dst, uint32_t pitch, uint32_t width, uint32_t height,
+                        uint32_t x, uint32_t y, const char* text, uint32_t fg, uint32_t bg) {
+    const glyph_cache_t* cache = glyph_cache_get(fg, bg);
+    if (!cache || y + g_font.height > height) return;
+
+    for (; *text && x + g_font.width <= width; text++, x += g_font.width) {
+        uint32_t c = (uint8_t)*text;
+        if (c < FONT_FIRST_CHAR || c >= FONT_FIRST_CHAR + FONT_GLYPH_COUNT) c = '?';
+        const uint32_t* glyph = &cache->pixels[(c - FONT_FIRST_CHAR) * g_font.width * g_font.height];
+        for (uint32_t row = 0; row < g_font.height; row++) {
+            uint32_t* out = &dst[(y + row) * pitch + x];
+            for (uint32_t col = 0; col < g_font.width; col++) {
+                out[col] = glyph[row * g_font.width + col];
+            }
+        }
+    }
+}
+
+/* Draws a string with opaque background and returns the x after the last glyph */
+static uint32_t draw_text(uint32_t x, uint32_t y, const char* text, uint32_t fg, uint32_t bg) {
+    glyph_cache_t* cache = glyph_cache_get(fg, bg);
+
+    for (; *text; text++, x += g_font.width) {
+        draw_glyph(x, y, (uint8_t)*text, cache, bg);
+    }
+    return x;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Event stream                                                              */
+/* ------------------------------------------------------------------------- */
+
+/* Publishes an event, overwriting the oldest one when the ring is full */
+static void event_push(uint32_t type, const workspace_t* ws, uint32_t handle, int32_t arg) {
+    uint64_t seq = g_event_head;
+    nrio_event_t* ev = &g_event_ring[seq & EVENT_RING_MASK];
+
+    ev->seq = seq;
+    ev->type = (uint16_t)type;
+    ev->workspace = (uint16_t)(ws - g_workspaces);
+    ev->handle = handle;
+    ev->arg = arg;
+    ev->reserved = 0;
+    __atomic_store_n(&g_event_head, seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies out every event from the reader's sequence number (its file position)
+ * that fits in the buffer. event_push() fills slot head & MASK before it
+ * publishes head + 1, so only the newest EVENT_RING_SIZE - 1 events are safe to
+ * read. If the producer laps the records while they are being copied, the copy
+ * is retried from the new oldest event.
+ */
+static vfs_ssize_t events_read(vfs_file_t* file, void* buf, size_t count, vfs_off_t* pos) {
+    (void)file;
+    nrio_event_t* out = buf;
+    size_t capacity = count / sizeof(nrio_event_t);
+    if (capacity == 0) return -EINVAL;
+
+    for (;;) {
+        uint64_t head = __atomic_load_n(&g_event_head, __ATOMIC_ACQUIRE);
+        uint64_t next = *pos < 0 ? 0 : (uint64_t)*pos;
+        uint64_t dropped = 0;
+        size_t written = 0;
+
+        if (next > head) next = head;
+        if (head - next > EVENT_RING_SIZE - 1) {
+            dropped = head - (EVENT_RING_SIZE - 1) - next;
+            next = head - (EVENT_RING_SIZE - 1);
+        }
+
+        if (dropped > 0) {
+            out[0].seq = next;
+            out[0].type = NRIO_EV_OVERRUN;
+            out[0].workspace = 0;
+            out[0].handle = 0;
+            out[0].arg = dropped > 0x7fffffff ? 0x7fffffff : (int32_t)dropped;
+            out[0].reserved = 0;
+            written = 1;
+        }
+
+        size_t n = head - next;
+        if (n > capacity - written) n = capacity - written;
+
+        /* At most two contiguous runs, split where the ring wraps */
+        size_t first = EVENT_RING_SIZE - (next & EVENT_RING_MASK);
+        if (first > n) first = n;
+        memory_copy(&out[written], &g_event_ring[next & EVENT_RING_MASK],
+                    first * sizeof(nrio_event_t));
+        memory_copy(&out[written + first], &g_event_ring[0],
+                    (n - first) * sizeof(nrio_event_t));
+
+        uint64_t head_after = __atomic_load_n(&g_event_head, __ATOMIC_ACQUIRE);
+        if (head_after - next >= EVENT_RING_SIZE) continue;
+
+        *pos = (vfs_off_t)(next + n);
+        return (vfs_ssize_t)((written + n) * sizeof(nrio_event_t));
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/* Latency histograms                                                        */
+/* ------------------------------------------------------------------------- */
+
+static uint32_t latency_bucket(uint64_t cycles) {
+    if (cycles < (1u << LATENCY_SUB_BITS)) return (uint32_t)cycles;
+
+    uint32_t msb = 63 - (uint32_t)__builtin_clzll(cycles);
+    uint32_t sub = (uint32_t)(cycles >> (msb - LATENCY_SUB_BITS)) & ((1u << LATENCY_SUB_BITS) - 1);
+    return ((msb - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) | sub;
+}
+
+/* Largest value that falls into a bucket */
+static uint64_t latency_bucket_limit(uint32_t bucket) {
+    if (bucket < (1u << LATENCY_SUB_BITS)) return bucket;
+
+    uint32_t shift = (bucket >> LATENCY_SUB_BITS) - 1;
+    uint64_t sub = bucket & ((1u << LATENCY_SUB_BITS) - 1);
+    uint64_t low = ((1ull << LATENCY_SUB_BITS) | sub) << shift;
+    return low + (1ull << shift) - 1;
+}
+
+static void latency_add(latency_hist_t* h, uint64_t cycles) {
+    if (h->count == 0 || cycles < h->min) h->min = cycles;
+    if (cycles > h->max) h->max = cycles;
+    h->count++;
+    h->total += cycles;
+    h->last = cycles;
+    h->buckets[latency_bucket(cycles)]++;
+}
+
+static void latency_record(uint32_t timer, uint64_t start) {
+    latency_add(&g_latency[timer], read_tsc() - start);
+}
+
+/* Upper bound of the bucket holding the pct-th percentile, clamped to min/max */
+static uint64_t latency_percentile(const latency_hist_t* h, uint32_t pct) {
+    if (h->count == 0) return 0;
+
+    uint64_t rank = (h->count * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            uint64_t limit = latency_bucket_limit(b);
+            if (limit < h->min) return h->min;
+            return limit < h->max ? limit : h->max;
+        }
+    }
+    return h->max;
+}
+
+static void latency_fill_report(void) {
+    for (uint32_t t = 0; t < NRIO_LATENCY_TIMERS; t++) {
+        const latency_hist_t* h = &g_latency[t];
+        nrio_latency_t* rec = &g_latency_report[t];
+        rec->timer = t;
+        rec->reserved = 0;
+        rec->count = h->count;
+        rec->last = h->last;
+        rec->min = h->min;
+        rec->max = h->max;
+        rec->p50 = latency_percentile(h, 50);
+        rec->p99 = latency_percentile(h, 99);
+        rec->total = h->total;
+    }
+}
+
+/* A read at offset 0 recomputes the percentiles; later offsets continue that copy */
+static vfs_ssize_t latency_read(vfs_file_t* file, void* buf, size_t count, vfs_off_t* pos) {
+    (void)file;
+    if (*pos < 0) return -EINVAL;
+    if (*pos == 0) latency_fill_report();
+    if ((size_t)*pos >= sizeof(g_latency_report)) return 0;
+
+    size_t n = sizeof(g_latency_report) - (size_t)*pos;
+    if (n > count) n = count;
+    memory_copy(buf, (const uint8_t*)g_latency_report + *pos, n);
+    *pos += (vfs_off_t)n;
+    return (vfs_ssize_t)n;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Trace device                                                              */
+/* ------------------------------------------------------------------------- */
+
+#ifdef NRIO_TRACE
+/* Chrome trace format; ts is in units of 1000 TSC cycles since the oldest event */
+static const char TRACE_JSON_HEADER[] =
+    "{\"otherData\":{\"ts_unit\":\"1000 TSC cycles\"},\"traceEvents\":[\n";
+static const char TRACE_JSON_FOOTER[] = "]}\n";
+
+#define TRACE_HEADER_SIZE (sizeof(TRACE_JSON_HEADER) - 1)
+#define TRACE_FOOTER_SIZE (sizeof(TRACE_JSON_FOOTER) - 1)
+
+/* Formats dump event `index` as exactly TRACE_JSON_LINE bytes, space padded */
+static void trace_format_line(uint32_t index, char* line) {
+    const trace_event_t* ev = &g_trace_dump[index];
+    uint64_t ts = ev->tsc - g_trace_dump[0].tsc;
+    char* out = line;
+
+    *out++ = index ? ',' : ' ';
+    out = put_str(out, "{\"name\":\"");
+    out = put_str(out, ev->name < TRACE_NAME_COUNT ? TRACE_NAMES[ev->name] : "?");
+    out = put_str(out, ev->phase == 'B' ? "\",\"ph\":\"B\",\"ts\":" : "\",\"ph\":\"E\",\"ts\":");
+    out = put_u64(out, ts / 1000, 1);
+    *out++ = '.';
+    out = put_u64(out, ts % 1000, 3);
+    out = put_str(out, ",\"pid\":1,\"tid\":1,\"args\":{\"arg\":");
+    out = put_u64(out, ev->arg, 1);
+    out = put_str(out, "}}");
+    while (out < line + TRACE_JSON_LINE - 1) *out++ = ' ';
+    *out = '\n';
+}
+
+/*
+ * A read at offset 0 copies the ring; later offsets continue that copy. Once
+ * the ring has wrapped, its oldest end events may have lost their begin
+ * events; those are left out so viewers do not show broken slices. The JSON
+ * is generated on the fly from the fixed-width lines.
+ */
+static vfs_ssize_t trace_read(vfs_file_t* file, void* buf, size_t count, vfs_off_t* pos) {
+    (void)file;
+    if (*pos < 0) return -EINVAL;
+
+    if (*pos == 0) {
+        uint64_t head = g_trace_head;
+        uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        uint32_t depth = 0;
+        g_trace_dump_count = 0;
+        for (uint64_t i = first; i < head; i++) {
+            const trace_event_t* ev = &g_trace_ring[i & TRACE_RING_MASK];
+            if (ev->phase == 'E') {
+                if (depth == 0) continue;
+                depth--;
+            } else {
+                depth++;
+            }
+            g_trace_dump[g_trace_dump_count++] = *ev;
+        }
+    }
+
+    size_t events_end = TRACE_HEADER_SIZE + (size_t)g_trace_dump_count * TRACE_JSON_LINE;
+    size_t size = events_end + TRACE_FOOTER_SIZE;
+    uint8_t* out = buf;
+    size_t done = 0;
+    char line[TRACE_JSON_LINE];
+
+    while (done < count && (size_t)*pos < size) {
+        size_t at = (size_t)*pos;
+        const char* src;
+        size_t avail;
+        if (at < TRACE_HEADER_SIZE) {
+            src = &TRACE_JSON_HEADER[at];
+            avail = TRACE_HEADER_SIZE - at;
+        } else if (at < events_end) {
+            size_t offset = (at - TRACE_HEADER_SIZE) % TRACE_JSON_LINE;
+            trace_format_line((uint32_t)((at - TRACE_HEADER_SIZE) / TRACE_JSON_LINE), line);
+            src = &line[offset];
+            avail = TRACE_JSON_LINE - offset;
+        } else {
+            src = &TRACE_JSON_FOOTER[at - events_end];
+            avail = size - at;
+        }
+
+        if (avail > count - done) avail = count - done;
+        memory_copy(out + done, src, avail);
+        done += avail;
+        *pos += (vfs_off_t)avail;
+    }
+    return (vfs_ssize_t)done;
+}
+#endif
+
+static uint32_t workspace_has_visible_focus(const workspace_t* ws) {
+    return ws->window_count > 0 && !ws->windows[ws->focused_window_index].is_hidden;
+}
+
+/* Emits a focus event if the workspace's focused window differs from the last one published */
+static void event_focus_changed(workspace_t* ws) {
+    uint32_t handle = workspace_has_visible_focus(ws)
+        ? ws->windows[ws->focused_window_index].handle : 0;
+    if (handle == ws->reported_focus) return;
+
+    ws->reported_focus = handle;
+    event_push(NRIO_EV_FOCUS, ws, handle, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Layout calculation functions                                              */
+/* ------------------------------------------------------------------------- */
+
+static void calculate_horizontal_layout(
+    window_position_t* positions,
+    uint32_t count,
+    uint32_t screen_width,
+    uint32_t gap,
+    uint32_t usable_height
+) {
+    uint32_t window_width = (screen_width - gap * (count + 1)) / count;
+    for (uint32_t i = 0; i < count; i++) {
+        positions[i].x = gap + i * (window_width + gap);
+        positions[i].y = g_bar_height + gap;
+        positions[i].width = window_width;
+        positions[i].height = usable_height - gap;
+    }
+}
+
+static void calculate_vertical_layout(
+    window_position_t* positions,
+    uint32_t count,
+    uint32_t screen_width,
+    uint32_t gap,
+    uint32_t usable_height
+) {
+    uint32_t window_height = (usable_height - gap * (count + 1)) / count;
+    for (uint32_t i = 0; i < count; i++) {
+        positions[i].x = gap;
+        positions[i].y = g_bar_height + gap + i * (window_height + gap);
+        positions[i].width = screen_width - gap * 2;
+        positions[i].height = window_height;
+    }
+}
+
+static void calculate_grid_layout(
+    window_position_t* positions,
+    uint32_t count,
+    uint32_t screen_width,
+    uint32_t gap,
+    uint32_t usable_height
+) {
+    uint32_t cols = 2;
+    uint32_t rows = (count + 1) / 2;
+    uint32_t cell_width = (screen_width - gap * (cols + 1)) / cols;
+    uint32_t cell_height = (usable_height - gap * (rows + 1)) / rows;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t col = i % cols;
+        uint32_t row = i / cols;
+        positions[i].x = gap + col * (cell_width + gap);
+        positions[i].y = g_bar_height + gap + row * (cell_height + gap);
+        positions[i].width = cell_width;
+        positions[i].height = cell_height;
+    }
+}
+
+static void calculate_fullscreen_layout(
+    window_position_t* positions,
+    uint32_t count,
+    uint32_t screen_width,
+    uint32_t gap,
+    uint32_t usable_height
+) {
+    for (uint32_t i = 0; i < count; i++) {
+        positions[i].x = gap;
+        positions[i].y = g_bar_height + gap;
+        positions[i].width = screen_width - gap * 2;
+        positions[i].height = usable_height - gap;
+    }
+}
+
+static void calculate_master_stack_layout(
+    window_position_t* positions,
+    uint32_t count,
+    uint32_t screen_width,
+    uint32_t gap,
+    uint32_t usable_height,
+    uint32_t master_ratio
+) {
+    if (count == 1) {
+        positions[0].x = gap;
+        positions[0].y = g_bar_height + gap;
+        positions[0].width = screen_width - gap * 2;
+        positions[0].height = usable_height - gap;
+    } else {
+        uint32_t master_width = (screen_width * master_ratio / 100) - gap * 2;
+        uint32_t stack_width = screen_width - master_width - gap * 3;
+
+        positions[0].x = gap;
+        positions[0].y = g_bar_height + gap;
+        positions[0].width = master_width;
+        positions[0].height = usable_height - gap;
+
+        uint32_t stack_count = count - 1;
+        uint32_t stack_height = (usable_height - gap * (stack_count + 1)) / stack_count;
+
+        for (uint32_t i = 1; i < count; i++) {
+            positions[i].x = master_width + gap * 2;
+            positions[i].y = g_bar_height + gap + (i - 1) * (stack_height + gap);
+            positions[i].width = stack_width;
+            positions[i].height = stack_height;
+        }
+    }
+}
+
+/* Lays windows out on an output; every output has its own top bar */
+static void compute_window_positions(
+    const output_t* out,
+    window_position_t* positions,
+    uint32_t count,
+    const layout_config_t* config
+) {
+    uint32_t gap = config->gap_size;
+    uint32_t width = out->width;
+    uint32_t usable_height = out->height - g_bar_height - gap;
+
+    for (uint32_t i = 0; i < count; i++) {
+        positions[i].x = 0;
+        positions[i].y = g_bar_height;
+        positions[i].width = 0;
+        positions[i].height = 0;
+    }
+
+    if (count == 0) return;
+    TRACE_BEGIN(TRACE_LAYOUT, count);
+
+    switch (config->type) {
+        case LAYOUT_HORIZONTAL:
+            calculate_horizontal_layout(positions, count, width, gap, usable_height);
+            break;
+        case LAYOUT_VERTICAL:
+            calculate_vertical_layout(positions, count, width, gap, usable_height);
+            break;
+        case LAYOUT_GRID:
+            calculate_grid_layout(positions, count, width, gap, usable_height);
+            break;
+        case LAYOUT_FULLSCREEN:
+            calculate_fullscreen_layout(positions, count, width, gap, usable_height);
+            break;
+        case LAYOUT_MASTER_STACK:
+            calculate_master_stack_layout(positions, count, width, gap, usable_height,
+                                          config->master_ratio);
+            break;
+        default:
+            break;
+    }
+    TRACE_END(TRACE_LAYOUT);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Drawing functions                                                         */
+/* ------------------------------------------------------------------------- */
+
+/* The top bar being built or painted belongs to g_output */
+static uint32_t bar_cell_count(void) {
+    uint32_t cols = g_output->width / g_font.width;
+    return cols < BAR_MAX_CELLS ? cols : BAR_MAX_CELLS;
+}
+
+/* Writes text into a cell grid and returns the column after it */
+static uint32_t bar_put_text(bar_cell_t* cells, uint32_t col, const char* text, uint32_t fg, uint32_t bg) {
+    uint32_t cols = bar_cell_count();
+    for (; *text && col < cols; text++, col++) {
+        cells[col].ch = (uint8_t)*text;
+        cells[col].fg = fg;
+        cells[col].bg = bg;
+    }
+    return col;
+}
+
+static uint32_t hud_first_cell(void) {
+    uint32_t cols = bar_cell_count();
+    return cols > HUD_CELLS ? cols - HUD_CELLS : 0;
+}
+
+/*
+ * Last and p99 redraw time, pixels written and damage of the last frame, and
+ * kernel memory in use, right-aligned over the end of the bar. The module has
+ * no calibrated TSC rate, so times are shown in cycles and labelled as such.
+ */
+static void bar_put_hud(bar_cell_t* cells) {
+    const latency_hist_t* redraw = &g_latency[NRIO_LATENCY_REDRAW];
+    uint64_t screen = (uint64_t)g_output->width * g_output->height;
+    uint64_t damage = screen ? g_last_frame_damage * 100 / screen : 0;
+    char text[HUD_CELLS + 1];
+    char* out = text;
+
+    out = put_str(out, "draw ");
+    out = put_si(out, redraw->last);
+    *out++ = '/';
+    out = put_si(out, latency_percentile(redraw, 99));
+    out = put_str(out, " cyc px ");
+    out = put_si(out, g_last_frame_pixels);
+    out = put_str(out, " dmg ");
+    out = put_u64(out, damage > 100 ? 100 : damage, 1);
+    out = put_str(out, "% kmem ");
+    out = put_si(out, g_kmem_in_use);
+    *out++ = ' ';
+    *out = '\0';
+
+    uint32_t first = hud_first_cell();
+    uint32_t len = (uint32_t)(out - text);
+    uint32_t cols = bar_cell_count();
+    for (uint32_t i = first; i < cols; i++) {
+        cells[i].ch = ' ';
+        cells[i].fg = COLOR_BAR_DIM;
+        cells[i].bg = COLOR_BAR_BG;
+    }
+    bar_put_text(cells, len < cols - first ? cols - len : first, text, COLOR_BAR_DIM, COLOR_BAR_BG);
+}
+
+/* The output's workspace numbers, its layout and the focused window's title */
+static void build_top_bar(bar_cell_t* cells) {
+    const output_t* output = g_output;
+    const workspace_t* active = &g_workspaces[output->workspace];
+    uint32_t cols = bar_cell_count();
+    char label[16];
+
+    for (uint32_t i = 0; i < cols; i++) {
+        cells[i].ch = ' ';
+        cells[i].fg = COLOR_BAR_TEXT;
+        cells[i].bg = COLOR_BAR_BG;
+    }
+
+    uint32_t col = BAR_TEXT_X / g_font.width;
+    for (uint32_t i = 0; i < output->workspace_count; i++) {
+        uint32_t w = output->first_workspace + i;
+        label[0] = ' ';
+        label[1] = (char)('1' + w);
+        label[2] = ' ';
+        label[3] = '\0';
+        if (w == output->workspace) {
+            col = bar_put_text(cells, col, label, COLOR_BAR_BG, COLOR_BAR_ACCENT);
+        } else {
+            uint32_t fg = g_workspaces[w].window_count ? COLOR_BAR_TEXT : COLOR_BAR_DIM;
+            col = bar_put_text(cells, col, label, fg, COLOR_BAR_BG);
+        }
+    }
+
+    label[0] = '[';
+    string_copy(&label[1], LAYOUT_NAMES[active->layout.type]);
+    uint32_t len = string_length(label);
+    label[len] = ']';
+    label[len + 1] = '\0';
+    col = bar_put_text(cells, col + 1, label, COLOR_BAR_TEXT, COLOR_BAR_BG);
+
+    if (workspace_has_visible_focus(active)) {
+        bar_put_text(cells, col + 1, active->windows[active->focused_window_index].title,
+                     COLOR_BAR_TEXT, COLOR_BAR_BG);
+    }
+
+    if (g_hud_enabled) bar_put_hud(cells);
+}
+
+/* Paints cells [from, to) of g_bar_next that differ from the screen; returns how many */
+static uint32_t bar_paint_cells(uint32_t from, uint32_t to) {
+    const glyph_cache_t* cache = NULL;
+    uint32_t painted = 0;
+
+    for (uint32_t i = from; i < to; i++) {
+        bar_cell_t* next = &g_bar_next[i];
+        bar_cell_t* cur = &g_output->bar_cells[i];
+        if (g_output->bar_valid && cur->ch == next->ch && cur->fg == next->fg && cur->bg == next->bg) {
+            continue;
+        }
+
+        if (!cache || cache->fg != next->fg || cache->bg != next->bg ||
+            !fb_format_equal(&cache->format, &g_output->native)) {
+            cache = glyph_cache_get(next->fg, next->bg);
+        }
+        draw_glyph(i * g_font.width, BAR_TEXT_Y, next->ch, cache, next->bg);
+        *cur = *next;
+        painted++;
+    }
+    return painted;
+}
+
+/*
+ * Rebuilds the bar as a cell grid and repaints only cells whose glyph or colors
+ * differ from what is on screen. The whole strip is filled only after the bar
+ * was invalidated (first frame, full redraws). Returns the damaged area.
+ */
+static uint64_t draw_top_bar(void) {
+    uint64_t damage = 0;
+
+    build_top_bar(g_bar_next);
+
+    if (!g_output->bar_valid) {
+        fill_rect(0, 0, g_output->width, g_bar_height, COLOR_BAR_BG);
+        damage = (uint64_t)g_output->width * g_bar_height;
+    }
+
+    uint32_t painted = bar_paint_cells(0, bar_cell_count());
+    g_output->bar_valid = 1;
+    if (damage == 0) damage = (uint64_t)painted * g_font.width * g_font.height;
+    return damage;
+}
+
+/* Refreshes only the HUD cells, outside any measured frame */
+static void hud_update(void) {
+    if (!g_hud_enabled || !g_output->bar_valid) return;
+
+    bar_put_hud(g_bar_next);
+    bar_paint_cells(hud_first_cell(), bar_cell_count());
+}
+
+/*
+ * Frames nest: a present at the end of a redraw belongs to the redraw. The
+ * outermost frame records its pixel writes and damage, then the HUD shows them.
+ */
+static void frame_begin(void) {
+    if (g_frame_depth++ > 0) return;
+    g_frame_start_pixels = g_pixels_written;
+    g_frame_damage = 0;
+    OVERDRAW_BEGIN();
+}
+
+static void frame_end(void) {
+    if (--g_frame_depth > 0) return;
+    OVERDRAW_END();
+    g_last_frame_pixels = g_pixels_written - g_frame_start_pixels;
+    g_last_frame_damage = g_frame_damage;
+    hud_update();
+}
+
+static uint32_t title_bar_height(void) {
+    return g_title_bars ? TITLE_BAR_HEIGHT : 0;
+}
+
+/* Re-renders the cached title strip if its title, width, focus or format changed */
+static const uint32_t* window_title_strip(window_t* win, uint32_t width, uint32_t is_focused) {
+    title_cache_t* tc = &win->title_cache;
+    if (tc->valid && tc->width == width && tc->focused == is_focused &&
+        fb_format_equal(&tc->format, &g_output->native) && string_equal(tc->title, win->title)) {
+        return tc->pixels;
+    }
+
+    uint32_t pixels = width * TITLE_BAR_HEIGHT;
+    if (tc->capacity < pixels) {
+        kmem_free(tc->pixels);
+        tc->pixels = kmem_alloc(pixels * sizeof(uint32_t));
+        tc->capacity = tc->pixels ? pixels : 0;
+        tc->valid = 0;
+        if (!tc->pixels) return NULL;
+    }
+
+    uint32_t fg = is_focused ? COLOR_BAR_TEXT : COLOR_TITLE_TEXT;
+    uint32_t bg = is_focused ? COLOR_TITLE_FOCUSED : COLOR_TITLE_BG;
+    uint32_t native_bg = g_output->format->convert(bg);
+    for (uint32_t i = 0; i < pixels; i++) {
+        tc->pixels[i] = native_bg;
+    }
+    render_text(tc->pixels, width, width, TITLE_BAR_HEIGHT, TITLE_TEXT_X, TITLE_TEXT_Y,
+                win->title, fg, bg);
+
+    tc->width = width;
+    tc->format = g_output->native;
+    tc->focused = (uint8_t)is_focused;
+    string_copy(tc->title, win->title);
+    tc->valid = 1;
+    return tc->pixels;
+}
+
+static void window_title_release(window_t* win) {
+    kmem_free(win->title_cache.pixels);
+    win->title_cache.pixels = NULL;
+    win->title_cache.capacity = 0;
+    win->title_cache.valid = 0;
+}
+
+/* Drops the glyph and title caches filled in a format an output has left */
+static void caches_drop_format(const struct fb_format* format) {
+    for (uint32_t i = 0; i < GLYPH_CACHE_SLOTS; i++) {
+        if (fb_format_equal(&g_glyph_caches[i].format, format)) g_glyph_caches[i].valid = 0;
+    }
+    for (uint32_t w = 0; w < WORKSPACE_COUNT; w++) {
+        for (uint32_t i = 0; i < g_workspaces[w].window_count; i++) {
+            title_cache_t* tc = &g_workspaces[w].windows[i].title_cache;
+            if (fb_format_equal(&tc->format, format)) tc->valid = 0;
+        }
+    }
+}
+
+/* Title strip rect inside the frame; empty when the frame is too short for it */
+static void window_title_rect(const window_position_t* position, uint32_t border_size,
+                              uint32_t is_focused, window_position_t* rect) {
+    uint32_t border = is_focused ? border_size * FOCUSED_BORDER_MULTIPLIER : border_size;
+    rect->x = position->x + border;
+    rect->y = position->y + border;
+    rect->width = position->width - border * 2;
+    rect->height = title_bar_height();
+    if (position->height - border * 2 <= rect->height) rect->height = 0;
+}
+
+static void draw_window_title(window_t* win, const window_position_t* position,
+                              uint32_t border_size, uint32_t is_focused) {
+    window_position_t rect;
+    window_title_rect(position, border_size, is_focused, &rect);
+    win->title_dirty = 0;
+    if (rect.height == 0) return;
+
+    const uint32_t* strip = window_title_strip(win, rect.width, is_focused);
+    if (strip) {
+        blit_native_rect(rect.x, rect.y, rect.width, rect.height, strip, rect.width);
+    } else {
+        fill_rect(rect.x, rect.y, rect.width, rect.height, COLOR_TITLE_BG);
+    }
+}
+
+static void draw_window_frame(
+    window_t* win,
+    const window_position_t* position,
+    uint32_t border_size,
+    uint32_t border_color,
+    uint32_t is_focused
+) {
+    uint32_t x = position->x;
+    uint32_t y = position->y;
+    uint32_t w = position->width;
+    uint32_t h = position->height;
+    uint32_t border = is_focused ? border_size * FOCUSED_BORDER_MULTIPLIER : border_size;
+    uint32_t inner_w = w - border * 2;
+    uint32_t inner_h = h - border * 2;
+    uint32_t title_h = title_bar_height();
+    const surface_t* s = win->surface;
+
+    TRACE_BEGIN(TRACE_FRAME, win->handle);
+    if (inner_h > title_h) {
+        draw_window_title(win, position, border_size, is_focused);
+        inner_h -= title_h;
+    } else {
+        title_h = 0;
+    }
+
+    if (s && s->width >= inner_w && s->height >= inner_h) {
+        /* The surface sits inside the normal border; a thicker focus border clips it */
+        uint32_t inset = border - border_size;
+        blit_rect(x + border, y + border + title_h, inner_w, inner_h,
+                  &s->pixels[inset * s->width + inset], s->width);
+    } else {
+        fill_rect(x + border, y + border + title_h, inner_w, inner_h, COLOR_WINDOW_BG);
+    }
+    fill_rect(x, y, w, border, border_color);
+    fill_rect(x, y + h - border, w, border, border_color);
+    fill_rect(x, y, border, h, border_color);
+    fill_rect(x + w - border, y, border, h, border_color);
+    TRACE_END(TRACE_FRAME);
+}
+
+static const char EMPTY_DESKTOP_TEXT[] = "~";
+
+static void empty_desktop_indicator_rect(window_position_t* rect) {
+    const char* text = EMPTY_DESKTOP_TEXT;
+    rect->width = string_length(text) * g_font.width;
+    rect->height = g_font.height;
+    rect->x = (g_output->width - rect->width) / 2;
+    rect->y = g_output->height / 2 - g_font.height / 2;
+}
+
+static void draw_empty_desktop_indicator(void) {
+    window_position_t rect;
+    empty_desktop_indicator_rect(&rect);
+    draw_text(rect.x, rect.y, EMPTY_DESKTOP_TEXT, COLOR_EMPTY_DESKTOP, COLOR_BAR_BG);
+}
+
+static uint32_t rect_equal(const window_position_t* a, const window_position_t* b) {
+    return a->x == b->x && a->y == b->y && a->width == b->width && a->height == b->height;
+}
+
+static uint32_t rect_intersects(const window_position_t* a, const window_position_t* b) {
+    return a->x < b->x + b->width && b->x < a->x + a->width &&
+           a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+static uint32_t rect_list_intersects(const window_position_t* list, uint32_t count,
+                                     const window_position_t* rect) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (rect_intersects(&list[i], rect)) return 1;
+    }
+    return 0;
+}
+
+/* Area covered by a list of rects, counting overlaps once */
+static uint64_t rect_list_area(const window_position_t* list, uint32_t count) {
+    uint32_t xs[(MAX_WINDOWS_PER_WORKSPACE * 2 + 1) * 2];
+    uint32_t starts[MAX_WINDOWS_PER_WORKSPACE * 2 + 1];
+    uint32_t ends[MAX_WINDOWS_PER_WORKSPACE * 2 + 1];
+    uint32_t nx = 0;
+    uint64_t area = 0;
+
+    if (count > MAX_WINDOWS_PER_WORKSPACE * 2 + 1) count = MAX_WINDOWS_PER_WORKSPACE * 2 + 1;
+    for (uint32_t i = 0; i < count; i++) {
+        xs[nx++] = list[i].x;
+        xs[nx++] = list[i].x + list[i].width;
+    }
+    for (uint32_t i = 1; i < nx; i++) {
+        for (uint32_t j = i; j > 0 && xs[j - 1] > xs[j]; j--) {
+            uint32_t t = xs[j];
+            xs[j] = xs[j - 1];
+            xs[j - 1] = t;
+        }
+    }
+
+    /* For each vertical slab, merge the y spans of the rects crossing it */
+    for (uint32_t i = 0; i + 1 < nx; i++) {
+        uint32_t x0 = xs[i], x1 = xs[i + 1];
+        uint32_t n = 0;
+        if (x0 == x1) continue;
+
+        for (uint32_t r = 0; r < count; r++) {
+            if (list[r].x > x0 || list[r].x + list[r].width < x1 || list[r].height == 0) continue;
+            uint32_t j = n++;
+            for (; j > 0 && starts[j - 1] > list[r].y; j--) {
+                starts[j] = starts[j - 1];
+                ends[j] = ends[j - 1];
+            }
+            starts[j] = list[r].y;
+            ends[j] = list[r].y + list[r].height;
+        }
+
+        uint32_t covered = 0, reach = 0;
+        for (uint32_t j = 0; j < n; j++) {
+            uint32_t from = starts[j] > reach ? starts[j] : reach;
+            if (ends[j] > from) covered += ends[j] - from;
+            if (ends[j] > reach) reach = ends[j];
+        }
+        area += (uint64_t)(x1 - x0) * covered;
+    }
+    return area;
+}
+
+/* Returns 1 if the window with this handle was on screen last frame with the same
+ * geometry and focus state, i.e. its pixels can be left alone. */
+static uint32_t window_unchanged(const output_t* out, const window_position_t* pos, uint32_t was_focused) {
+    for (uint32_t i = 0; i < out->prev_window_count; i++) {
+        if (out->prev_positions[i].handle == pos->handle) {
+            return rect_equal(&out->prev_positions[i], pos) &&
+                   was_focused == (pos->handle == out->prev_focused_handle);
+        }
+    }
+    return 0;
+}
+
+static int find_on_screen(const output_t* out, uint32_t handle) {
+    for (uint32_t i = 0; i < out->prev_window_count; i++) {
+        if (out->prev_positions[i].handle == handle) return (int)i;
+    }
+    return -1;
+}
+
+/* A window is occluded if something painted after it overlaps its rect */
+static uint32_t window_occluded(const output_t* out, uint32_t slot) {
+    const window_position_t* pos = &out->prev_positions[slot];
+    if (pos->handle == out->prev_focused_handle) return 0;
+
+    for (uint32_t i = 0; i < out->prev_window_count; i++) {
+        if (i == slot) continue;
+        uint32_t above = out->prev_positions[i].handle == out->prev_focused_handle || i > slot;
+        if (above && rect_intersects(&out->prev_positions[i], pos)) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Composites only the damaged parts of each on-screen surface, clipped to the
+ * frame interior. Damage on windows that are not on screen is kept; they get a
+ * full blit the next time they are drawn.
+ */
+static void present_damage(output_t* out) {
+    workspace_t* ws = &g_workspaces[out->workspace];
+    uint32_t border_size = ws->layout.border_size;
+
+    if (!out->framebuffer) return;
+    uint64_t start = read_tsc();
+
+    g_output = out;
+    out->present_pending = 0;
+    frame_begin();
+    TRACE_BEGIN(TRACE_PRESENT, 0);
+    for (uint32_t i = 0; i < ws->window_count; i++) {
+        window_t* win = &ws->windows[i];
+        const surface_t* s = win->surface;
+        if (win->damage_count == 0 || win->is_hidden || !s) continue;
+
+        int slot = find_on_screen(out, win->handle);
+        if (slot < 0) continue;
+        uint32_t damage_count = win->damage_count;
+        win->damage_count = 0;
+        if (window_occluded(out, (uint32_t)slot)) continue;
+
+        const window_position_t* pos = &out->prev_positions[slot];
+        uint32_t border = pos->handle == out->prev_focused_handle
+            ? border_size * FOCUSED_BORDER_MULTIPLIER : border_size;
+        uint32_t inset = border - border_size;
+        if (s->width <= inset * 2 || s->height <= inset * 2) continue;
+
+        for (uint32_t d = 0; d < damage_count; d++) {
+            const rect_t* r = &win->damage[d];
+            uint32_t x0 = r->x > inset ? r->x : inset;
+            uint32_t y0 = r->y > inset ? r->y : inset;
+            uint32_t x1 = r->x + r->width;
+            uint32_t y1 = r->y + r->height;
+            if (x1 > s->width - inset) x1 = s->width - inset;
+            if (y1 > s->height - inset) y1 = s->height - inset;
+            if (x0 >= x1 || y0 >= y1) continue;
+
+            blit_rect(pos->x + border_size + x0, pos->y + border_size + title_bar_height() + y0,
+                      x1 - x0, y1 - y0, &s->pixels[y0 * s->width + x0], s->width);
+            g_frame_damage += (uint64_t)(x1 - x0) * (y1 - y0);
+        }
+    }
+    TRACE_END(TRACE_PRESENT);
+    latency_record(NRIO_LATENCY_PRESENT, start);
+    frame_end();
+}
+
+/*
+ * Lays out the visible windows of the workspace an output shows and repaints
+ * only what differs from that output's previous frame: old rects that are no
+ * longer occupied are cleared, and a window is drawn if its rect or focus
+ * changed or something painted before it this frame overlaps it. The focused
+ * window is painted last so it stays on top in overlapping layouts.
+ */
+static void redraw_incremental(output_t* out) {
+    workspace_t* ws = &g_workspaces[out->workspace];
+    uint32_t border = ws->layout.border_size;
+    if (!out->framebuffer) return;
+    uint64_t start = read_tsc();
+
+    uint32_t* visible = arena_alloc(&g_frame_arena, sizeof(uint32_t) * MAX_WINDOWS_PER_WORKSPACE);
+    window_position_t* positions = arena_alloc(&g_frame_arena,
+                                               sizeof(window_position_t) * MAX_WINDOWS_PER_WORKSPACE);
+    window_position_t* painted = arena_alloc(&g_frame_arena,
+                                             sizeof(window_position_t) * (MAX_WINDOWS_PER_WORKSPACE * 2 + 1));
+    if (!visible || !positions || !painted) {
+        arena_reset(&g_frame_arena);
+        return;
+    }
+    g_output = out;
+    frame_begin();
+    TRACE_BEGIN(TRACE_REDRAW, out->workspace);
+
+    uint32_t count = 0;
+    uint32_t focused_slot = MAX_WINDOWS_PER_WORKSPACE;
+    for (uint32_t i = 0; i < ws->window_count; i++) {
+        if (ws->windows[i].is_hidden) continue;
+        if (i == ws->focused_window_index) focused_slot = count;
+        visible[count++] = i;
+    }
+
+    compute_window_positions(out, positions, count, &ws->layout);
+    for (uint32_t k = 0; k < count; k++) {
+        positions[k].pid = ws->windows[visible[k]].pid;
+        positions[k].handle = ws->windows[visible[k]].handle;
+    }
+    uint32_t focused_handle = workspace_has_visible_focus(ws)
+        ? ws->windows[ws->focused_window_index].handle : 0;
+
+    uint32_t painted_count = 0;
+    if (out->needs_full_redraw) {
+        clear_screen();
+        out->bar_valid = 0;
+        out->prev_window_count = 0;
+    } else {
+        TRACE_BEGIN(TRACE_CLEAR_STALE, out->prev_window_count);
+        for (uint32_t i = 0; i < out->prev_window_count; i++) {
+            uint32_t reused = 0;
+            for (uint32_t k = 0; k < count && !reused; k++) {
+                reused = rect_equal(&out->prev_positions[i], &positions[k]);
+            }
+            if (reused) continue;
+
+            fill_rect(out->prev_positions[i].x, out->prev_positions[i].y,
+                     out->prev_positions[i].width, out->prev_positions[i].height,
+                     COLOR_BAR_BG);
+            painted[painted_count++] = out->prev_positions[i];
+        }
+
+        if (out->prev_window_count == 0 && count > 0) {
+            empty_desktop_indicator_rect(&painted[painted_count]);
+            fill_rect(painted[painted_count].x, painted[painted_count].y,
+                     painted[painted_count].width, painted[painted_count].height,
+                     COLOR_BAR_BG);
+            painted_count++;
+        }
+        TRACE_END(TRACE_CLEAR_STALE);
+    }
+
+    if (count == 0) {
+        if (out->prev_window_count != 0 || out->needs_full_redraw) {
+            draw_empty_desktop_indicator();
+            empty_desktop_indicator_rect(&painted[painted_count++]);
+        }
+    } else {
+        TRACE_BEGIN(TRACE_PAINT_WINDOWS, count);
+        for (uint32_t n = 0; n < count; n++) {
+            /* Paint in layout order with the focused window moved to the end */
+            uint32_t k = n;
+            if (focused_slot < count) {
+                if (n == count - 1) k = focused_slot;
+                else if (n >= focused_slot) k = n + 1;
+            }
+
+            window_t* win = &ws->windows[visible[k]];
+            uint32_t is_focused = positions[k].handle == focused_handle;
+            if (!out->needs_full_redraw && window_unchanged(out, &positions[k], is_focused) &&
+                !rect_list_intersects(painted, painted_count, &positions[k])) {
+                if (win->title_dirty) {
+                    /* Only the title changed: repaint just its strip */
+                    draw_window_title(win, &positions[k], border, is_focused);
+                    window_title_rect(&positions[k], border, is_focused, &painted[painted_count]);
+                    if (painted[painted_count].height) painted_count++;
+                }
+                continue;
+            }
+
+            uint32_t old_w = win->surface ? win->surface->width : 0;
+            uint32_t old_h = win->surface ? win->surface->height : 0;
+            uint32_t frame_h = border * 2 + title_bar_height();
+            window_fit_surface(win,
+                               positions[k].width > border * 2 ? positions[k].width - border * 2 : 0,
+                               positions[k].height > frame_h ? positions[k].height - frame_h : 0);
+            if (win->surface && (win->surface->width != old_w || win->surface->height != old_h)) {
+                event_push(NRIO_EV_SURFACE_RESIZE, ws, win->handle,
+                           (int32_t)((win->surface->width << 16) | win->surface->height));
+            }
+            draw_window_frame(win, &positions[k], border, ws->layout.border_color, is_focused);
+            win->damage_count = 0;
+            painted[painted_count++] = positions[k];
+        }
+        TRACE_END(TRACE_PAINT_WINDOWS);
+    }
+
+    g_frame_damage += out->needs_full_redraw
+        ? (uint64_t)out->width * (out->height - g_bar_height)
+        : rect_list_area(painted, painted_count);
+
+    TRACE_BEGIN(TRACE_TOP_BAR, 0);
+    g_frame_damage += draw_top_bar();
+    TRACE_END(TRACE_TOP_BAR);
+
+    for (uint32_t k = 0; k < count; k++) {
+        out->prev_positions[k] = positions[k];
+    }
+    out->prev_window_count = count;
+    out->prev_focused_handle = focused_handle;
+    out->needs_full_redraw = 0;
+
+    present_damage(out);
+    TRACE_END(TRACE_REDRAW);
+    arena_reset(&g_frame_arena);
+    latency_record(NRIO_LATENCY_REDRAW, start);
+    frame_end();
+}
+
+/* ------------------------------------------------------------------------- */
+/* Workspace and window management                                           */
+/* ------------------------------------------------------------------------- */
+
+static void initialize_workspaces(void) {
+    for (uint32_t i = 0; i < WORKSPACE_COUNT; i++) {
+        workspace_t* ws = &g_workspaces[i];
+        ws->window_count = 0;
+        ws->layout = DEFAULT_LAYOUTS[LAYOUT_GRID];
+        ws->focused_window_index = 0;
+        ws->reported_focus = 0;
+        for (uint32_t j = 0; j < MAX_WINDOWS_PER_WORKSPACE; j++) {
+            ws->windows[j].is_open = 0;
+            ws->windows[j].is_hidden = 0;
+            ws->windows[j].title[0] = '\0';
+            ws->windows[j].surface = NULL;
+            ws->windows[j].damage_count = 0;
+            ws->windows[j].title_cache.pixels = NULL;
+            ws->windows[j].title_cache.capacity = 0;
+            ws->windows[j].title_cache.valid = 0;
+            ws->windows[j].title_dirty = 0;
+        }
+    }
+}
+
+/* Outputs own contiguous runs of workspaces, see outputs_assign_workspaces() */
+static output_t* workspace_output(const workspace_t* ws) {
+    uint32_t index = (uint32_t)(ws - g_workspaces);
+    for (uint32_t o = 0; o + 1 < g_output_count; o++) {
+        if (index < g_outputs[o].first_workspace + g_outputs[o].workspace_count) return &g_outputs[o];
+    }
+    return &g_outputs[g_output_count ? g_output_count - 1 : 0];
+}
+
+/* The workspace shown on the active output, which hotkeys and commands act on */
+static workspace_t* active_workspace(void) {
+    return &g_workspaces[g_outputs[g_active_output].workspace];
+}
+
+/* Called by every mutation: bumps the state version and redraws the output
+ * now, or once at the end of the current command batch */
+static void request_redraw(output_t* out) {
+    g_state_version++;
+    if (g_batch_depth > 0) {
+        out->redraw_pending = 1;
+        return;
+    }
+    redraw_incremental(out);
+}
+
+/* For settings that show on every output */
+static void request_redraw_all(void) {
+    for (uint32_t o = 0; o < g_output_count; o++) {
+        request_redraw(&g_outputs[o]);
+    }
+}
+
+/* Batches are the seqlock write side: state may only change inside one */
+static void begin_batch(void) {
+    if (g_batch_depth++ == 0) {
+        __atomic_store_n(&g_state_seq, g_state_seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * Runs the pending redraw or present of every output, once each. A redraw
+ * presents as well. Inside a batch this waits for end_batch().
+ */
+static void flush_outputs(void) {
+    if (g_batch_depth > 0) return;
+
+    for (uint32_t o = 0; o < g_output_count; o++) {
+        output_t* out = &g_outputs[o];
+        if (out->redraw_pending) {
+            out->redraw_pending = 0;
+            redraw_incremental(out);
+        } else if (out->present_pending) {
+            present_damage(out);
+        }
+    }
+}
+
+static void end_batch(void) {
+    if (--g_batch_depth > 0) return;
+
+    __atomic_store_n(&g_state_seq, g_state_seq + 1, __ATOMIC_RELEASE);
+    flush_outputs();
+}
+
+static uint32_t find_window(uint32_t handle, uint32_t* ws_index, uint32_t* win_index) {
+    for (uint32_t w = 0; w < WORKSPACE_COUNT; w++) {
+        workspace_t* ws = &g_workspaces[w];
+        for (uint32_t i = 0; i < ws->window_count; i++) {
+            if (ws->windows[i].handle == handle) {
+                *ws_index = w;
+                *win_index = i;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Moves focus to the nearest visible window starting at `start`, stepping by `direction` */
+static void focus_visible_from(workspace_t* ws, uint32_t start, int direction) {
+    for (uint32_t step = 0; step < ws->window_count; step++) {
+        uint32_t i = direction > 0
+            ? (start + step) % ws->window_count
+            : (start + ws->window_count - step % ws->window_count) % ws->window_count;
+        if (!ws->windows[i].is_hidden) {
+            ws->focused_window_index = i;
+            return;
+        }
+    }
+}
+
+/* Returns the new window's handle, or 0 if the workspace is full */
+static uint32_t add_window(workspace_t* ws, const char* title) {
+    if (ws->window_count >= MAX_WINDOWS_PER_WORKSPACE) return 0;
+
+    window_t* win = &ws->windows[ws->window_count];
+    string_copy(win->title, title);
+    win->is_open = 1;
+    win->is_hidden = 0;
+    win->pid = ws->window_count;
+    win->handle = g_next_handle++;
+    win->surface = NULL;
+    win->damage_count = 0;
+    win->title_cache.pixels = NULL;
+    win->title_cache.capacity = 0;
+    win->title_cache.valid = 0;
+    win->title_dirty = 0;
+    ws->window_count++;
+    ws->focused_window_index = ws->window_count - 1;
+    event_push(NRIO_EV_WINDOW_NEW, ws, win->handle, (int32_t)(ws - g_workspaces));
+    event_focus_changed(ws);
+    request_redraw(workspace_output(ws));
+    return win->handle;
+}
+
+static void add_window_to_current_workspace(const char* title) {
+    add_window(active_workspace(), title);
+}
+
+static void close_window(workspace_t* ws, uint32_t index) {
+    uint32_t focused = ws->focused_window_index;
+    event_push(NRIO_EV_WINDOW_CLOSE, ws, ws->windows[index].handle, 0);
+    surface_release(ws->windows[index].surface);
+    window_title_release(&ws->windows[index]);
+    for (uint32_t i = index; i < ws->window_count - 1; i++) {
+        ws->windows[i] = ws->windows[i + 1];
+    }
+
+    ws->window_count--;
+    ws->windows[ws->window_count].surface = NULL;
+    ws->windows[ws->window_count].title_cache.pixels = NULL;
+    ws->windows[ws->window_count].title_cache.capacity = 0;
+    if (ws->window_count == 0) {
+        ws->focused_window_index = 0;
+    } else if (index != focused) {
+        if (index < focused) ws->focused_window_index = focused - 1;
+    } else if (focused >= ws->window_count) {
+        ws->focused_window_index = ws->window_count - 1;
+        focus_visible_from(ws, ws->focused_window_index, -1);
+    } else {
+        focus_visible_from(ws, focused, 1);
+    }
+
+    event_focus_changed(ws);
+    request_redraw(workspace_output(ws));
+}
+
+static void close_current_window(void) {
+    workspace_t* ws = active_workspace();
+    if (!workspace_has_visible_focus(ws)) return;
+    close_window(ws, ws->focused_window_index);
+}
+
+static void cycle_focus(int direction) {
+    workspace_t* ws = active_workspace();
+    if (!workspace_has_visible_focus(ws)) return;
+
+    if (direction > 0) {
+        focus_visible_from(ws, (ws->focused_window_index + 1) % ws->window_count, 1);
+    } else {
+        focus_visible_from(ws, (ws->focused_window_index + ws->window_count - 1) % ws->window_count, -1);
+    }
+    event_focus_changed(ws);
+    request_redraw(workspace_output(ws));
+}
+
+/*
+ * Makes an output the one hotkeys and commands act on. Nothing on screen
+ * depends on it, so nothing is repainted, but the snapshot reports it.
+ */
+static void focus_output(uint32_t index) {
+    if (index >= g_output_count || index == g_active_output) return;
+    g_active_output = index;
+    g_state_version++;
+    event_push(NRIO_EV_OUTPUT, &g_workspaces[g_outputs[index].workspace], 0, (int32_t)index);
+}
+
+static void cycle_output(void) {
+    if (g_output_count > 1) focus_output((g_active_output + 1) % g_output_count);
+}
+
+/* Shows a workspace on the output it belongs to and focuses that output */
+static void switch_workspace(uint32_t index) {
+    if (index >= WORKSPACE_COUNT) return;
+    output_t* out = workspace_output(&g_workspaces[index]);
+    focus_output((uint32_t)(out - g_outputs));
+    if (index == out->workspace) return;
+
+    out->workspace = index;
+    event_push(NRIO_EV_WORKSPACE, &g_workspaces[index], 0, (int32_t)index);
+    request_redraw(out);
+}
+
+/* Parks a window in the scratchpad; it keeps its title and surface */
+static void hide_window(workspace_t* ws, uint32_t index) {
+    window_t* win = &ws->windows[index];
+    if (win->is_hidden) return;
+
+    win->is_hidden = 1;
+    win->hidden_seq = ++g_hide_seq;
+    if (index == ws->focused_window_index) {
+        focus_visible_from(ws, index, 1);
+    }
+    event_push(NRIO_EV_HIDE, ws, win->handle, 0);
+    event_focus_changed(ws);
+    request_redraw(workspace_output(ws));
+}
+
+static void hide_current_window(void) {
+    workspace_t* ws = active_workspace();
+    if (!workspace_has_visible_focus(ws)) return;
+    hide_window(ws, ws->focused_window_index);
+}
+
+static void show_window(workspace_t* ws, uint32_t index) {
+    if (ws->windows[index].is_hidden) {
+        ws->windows[index].is_hidden = 0;
+        event_push(NRIO_EV_SHOW, ws, ws->windows[index].handle, 0);
+    }
+    ws->focused_window_index = index;
+    event_focus_changed(ws);
+    request_redraw(workspace_output(ws));
+}
+
+/* Brings back the most recently parked window and focuses it */
+static void show_last_hidden_window(void) {
+    workspace_t* ws = active_workspace();
+    window_t* last = NULL;
+    uint32_t last_index = 0;
+
+    for (uint32_t i = 0; i < ws->window_count; i++) {
+        window_t* win = &ws->windows[i];
+        if (win->is_hidden && (!last || win->hidden_seq > last->hidden_seq)) {
+            last = win;
+            last_index = i;
+        }
+    }
+    if (!last) return;
+
+    show_window(ws, last_index);
+}
+
+static void set_layout(workspace_t* ws, layout_type_t type) {
+    ws->layout = DEFAULT_LAYOUTS[type];
+    event_push(NRIO_EV_LAYOUT, ws, 0, (int32_t)type);
+    request_redraw(workspace_output(ws));
+}
+
+static void cycle_layout(void) {
+    workspace_t* ws = active_workspace();
+    set_layout(ws, (ws->layout.type + 1) % LAYOUT_COUNT);
+}
+
+static void set_window_title(workspace_t* ws, uint32_t index, const char* title) {
+    window_t* win = &ws->windows[index];
+    if (string_equal(win->title, title)) return;
+
+    string_copy(win->title, title);
+    win->title_dirty = 1;
+    event_push(NRIO_EV_TITLE, ws, win->handle, 0);
+    request_redraw(workspace_output(ws));
+}
+
+/* Toggling title strips changes every frame's geometry, so repaint everything */
+static void set_title_bars(uint32_t enabled) {
+    if (g_title_bars == (enabled != 0)) return;
+    g_title_bars = enabled != 0;
+    for (uint32_t o = 0; o < g_output_count; o++) {
+        g_outputs[o].needs_full_redraw = 1;
+    }
+    request_redraw_all();
+}
+
+/* The HUD only adds or removes cells in the top bar; the redraw diffs them */
+static void set_hud(uint32_t enabled) {
+    if (g_hud_enabled == (enabled != 0)) return;
+    g_hud_enabled = enabled != 0;
+    request_redraw_all();
+}
+
+static void set_master_ratio(workspace_t* ws, uint32_t ratio) {
+    if (ratio < MASTER_RATIO_MIN) ratio = MASTER_RATIO_MIN;
+    if (ratio > MASTER_RATIO_MAX) ratio = MASTER_RATIO_MAX;
+    ws->layout.master_ratio = ratio;
+    event_push(NRIO_EV_RATIO, ws, 0, (int32_t)ratio);
+    request_redraw(workspace_output(ws));
+}
+
+/* ------------------------------------------------------------------------- */
+/* Control device                                                            */
+/* ------------------------------------------------------------------------- */
+
+/* Applies one parsed command; the caller holds a batch so nothing redraws here */
+static void apply_command(const wm_command_t* cmd) {
+    workspace_t* ws = active_workspace();
+    uint32_t ws_index, win_index;
+
+    switch (cmd->op) {
+        case CMD_NEW:
+            add_window(ws, cmd->title);
+            break;
+        case CMD_CLOSE:
+            if (cmd->handle == 0) {
+                close_current_window();
+            } else if (find_window(cmd->handle, &ws_index, &win_index)) {
+                close_window(&g_workspaces[ws_index], win_index);
+            }
+            break;
+        case CMD_FOCUS:
+            if (cmd->handle == 0) {
+                cycle_focus(cmd->arg);
+            } else if (find_window(cmd->handle, &ws_index, &win_index)) {
+                switch_workspace(ws_index);
+                show_window(&g_workspaces[ws_index], win_index);
+            }
+            break;
+        case CMD_LAYOUT:
+            if (cmd->arg < 0) cycle_layout();
+            else set_layout(ws, (layout_type_t)cmd->arg);
+            break;
+        case CMD_WORKSPACE:
+            switch_workspace((uint32_t)cmd->arg);
+            break;
+        case CMD_RATIO:
+            set_master_ratio(ws, (uint32_t)cmd->arg);
+            break;
+        case CMD_HIDE:
+            if (cmd->handle == 0) {
+                hide_current_window();
+            } else if (find_window(cmd->handle, &ws_index, &win_index)) {
+                hide_window(&g_workspaces[ws_index], win_index);
+            }
+            break;
+        case CMD_SHOW:
+            if (cmd->handle == 0) {
+                show_last_hidden_window();
+            } else if (find_window(cmd->handle, &ws_index, &win_index)) {
+                show_window(&g_workspaces[ws_index], win_index);
+            }
+            break;
+        case CMD_TITLE:
+            if (cmd->handle == 0) {
+                if (workspace_has_visible_focus(ws)) {
+                    set_window_title(ws, ws->focused_window_index, cmd->title);
+                }
+            } else if (find_window(cmd->handle, &ws_index, &win_index)) {
+                set_window_title(&g_workspaces[ws_index], win_index, cmd->title);
+            }
+            break;
+        case CMD_TITLES:
+            set_title_bars((uint32_t)cmd->arg);
+            break;
+        case CMD_HUD:
+            set_hud((uint32_t)cmd->arg);
+            break;
+        case CMD_OUTPUT:
+            focus_output((uint32_t)cmd->arg);
+            break;
+        default:
+            break;
+    }
+}
+
+static uint32_t is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* Splits off the next whitespace-delimited word of [*p, end) */
+static uint32_t next_word(const char** p, const char* end, const char** word) {
+    while (*p < end && is_space(**p)) (*p)++;
+    *word = *p;
+    while (*p < end && !is_space(**p)) (*p)++;
+    return (uint32_t)(*p - *word);
+}
+
+static uint32_t word_equals(const char* word, uint32_t len, const char* literal) {
+    uint32_t i = 0;
+    for (; i < len; i++) {
+        if (literal[i] == '\0' || literal[i] != word[i]) return 0;
+    }
+    return literal[i] == '\0';
+}
+
+static uint32_t parse_number(const char* word, uint32_t len, uint32_t* value) {
+    if (len == 0 || len > 9) return 0;
+    *value = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (word[i] < '0' || word[i] > '9') return 0;
+        *value = *value * 10 + (uint32_t)(word[i] - '0');
+    }
+    return 1;
+}
+
+/* Copies the rest of the line, trimmed, as a window title */
+static uint32_t parse_title(const char* p, const char* end, char* title) {
+    while (p < end && is_space(*p)) p++;
+    while (end > p && is_space(end[-1])) end--;
+    uint32_t n = 0;
+    for (; p < end && n < NRIO_TITLE_MAX - 1; p++) title[n++] = *p;
+    title[n] = '\0';
+    return n;
+}
+
+/*
+ * Parses one line of the text protocol:
+ *   new [title] | close [handle] | focus next|prev|<handle> |
+ *   layout next|<name> | workspace <1..N> | ratio <percent> |
+ *   hide [handle] | show [handle] | title <handle> <text> | titles on|off |
+ *   hud on|off | output <1..N>
+ * Returns 1 for a command, 0 for a blank or comment line, -1 on error.
+ */
+static int parse_text_command(const char* line, const char* end, wm_command_t* cmd) {
+    const char* p = line;
+    const char* word;
+    uint32_t len = next_word(&p, end, &word);
+    uint32_t value;
+
+    if (len == 0 || word[0] == '#') return 0;
+
+    cmd->handle = 0;
+    cmd->arg = 0;
+    cmd->title[0] = '\0';
+
+    if (word_equals(word, len, "new")) {
+        cmd->op = CMD_NEW;
+        if (parse_title(p, end, cmd->title) == 0) string_copy(cmd->title, "template");
+        return 1;
+    }
+
+    if (word_equals(word, len, "title")) {
+        cmd->op = CMD_TITLE;
+        len = next_word(&p, end, &word);
+        if (!parse_number(word, len, &value)) return -1;
+        cmd->handle = value;
+        parse_title(p, end, cmd->title);
+        return 1;
+    }
+
+    if (word_equals(word, len, "close")) cmd->op = CMD_CLOSE;
+    else if (word_equals(word, len, "hide")) cmd->op = CMD_HIDE;
+    else if (word_equals(word, len, "show")) cmd->op = CMD_SHOW;
+    else if (word_equals(word, len, "focus")) cmd->op = CMD_FOCUS;
+    else if (word_equals(word, len, "layout")) cmd->op = CMD_LAYOUT;
+    else if (word_equals(word, len, "workspace")) cmd->op = CMD_WORKSPACE;
+    else if (word_equals(word, len, "ratio")) cmd->op = CMD_RATIO;
+    else if (word_equals(word, len, "titles")) cmd->op = CMD_TITLES;
+    else if (word_equals(word, len, "hud")) cmd->op = CMD_HUD;
+    else if (word_equals(word, len, "output")) cmd->op = CMD_OUTPUT;
+    else return -1;
+
+    len = next_word(&p, end, &word);
+    switch (cmd->op) {
+        case CMD_CLOSE:
+        case CMD_HIDE:
+        case CMD_SHOW:
+            if (len == 0) break;
+            if (!parse_number(word, len, &value) || value == 0) return -1;
+            cmd->handle = value;
+            break;
+        case CMD_FOCUS:
+            if (word_equals(word, len, "next")) cmd->arg = 1;
+            else if (word_equals(word, len, "prev")) cmd->arg = -1;
+            else if (parse_number(word, len, &value) && value != 0) cmd->handle = value;
+            else return -1;
+            break;
+        case CMD_LAYOUT:
+            cmd->arg = -1;
+            if (word_equals(word, len, "next")) break;
+            for (uint32_t t = 0; t < LAYOUT_COUNT; t++) {
+                if (word_equals(word, len, LAYOUT_NAMES[t])) cmd->arg = (int32_t)t;
+            }
+            if (cmd->arg < 0) return -1;
+            break;
+        case CMD_WORKSPACE:
+            if (!parse_number(word, len, &value) || value == 0 || value > WORKSPACE_COUNT) return -1;
+            cmd->arg = (int32_t)(value - 1);
+            break;
+        case CMD_OUTPUT:
+            if (!parse_number(word, len, &value) || value == 0 || value > g_output_count) return -1;
+            cmd->arg = (int32_t)(value - 1);
+            break;
+        case CMD_RATIO:
+            if (!parse_number(word, len, &value) || value > 100) return -1;
+            cmd->arg = (int32_t)value;
+            break;
+        case CMD_TITLES:
+        case CMD_HUD:
+            if (word_equals(word, len, "on")) cmd->arg = 1;
+            else if (word_equals(word, len, "off")) cmd->arg = 0;
+            else return -1;
+            break;
+        default:
+            break;
+    }
+
+    /* Trailing garbage makes the whole line invalid */
+    if (next_word(&p, end, &word) != 0) return -1;
+    return 1;
+}
+
+/* Walks every line of a text batch, applying commands only when `apply` is set */
+static int run_text_commands(const char* buf, size_t count, uint32_t apply) {
+    const char* end = buf + count;
+    const char* line = buf;
+
+    while (line < end) {
+        const char* eol = line;
+        while (eol < end && *eol != '\n') eol++;
+
+        wm_command_t cmd;
+        int parsed = parse_text_command(line, eol, &cmd);
+        if (parsed < 0) return -1;
+        if (parsed > 0 && apply) apply_command(&cmd);
+
+        line = eol + 1;
+    }
+    return 0;
+}
+
+/* Converts a binary record into a command, rejecting anything out of range */
+static int decode_binary_command(const nrio_bin_record_t* rec, wm_command_t* cmd) {
+    /* Reserved bytes must be zero so they can be given a meaning later */
+    for (uint32_t i = 0; i < sizeof(rec->reserved); i++) {
+        if (rec->reserved[i]) return -1;
+    }
+
+    cmd->handle = rec->handle;
+    cmd->arg = rec->arg;
+    cmd->title[0] = '\0';
+
+    switch (rec->opcode) {
+        case NRIO_OP_NEW:
+        case NRIO_OP_TITLE:
+            cmd->op = rec->opcode == NRIO_OP_NEW ? CMD_NEW : CMD_TITLE;
+            for (uint32_t i = 0; i < NRIO_TITLE_MAX; i++) {
+                cmd->title[i] = rec->title[i];
+                if (rec->title[i] == '\0') break;
+            }
+            cmd->title[NRIO_TITLE_MAX - 1] = '\0';
+            return 0;
+        case NRIO_OP_TITLES:
+            cmd->op = CMD_TITLES;
+            return (cmd->arg == 0 || cmd->arg == 1) ? 0 : -1;
+        case NRIO_OP_HUD:
+            cmd->op = CMD_HUD;
+            return (cmd->arg == 0 || cmd->arg == 1) ? 0 : -1;
+        case NRIO_OP_OUTPUT:
+            cmd->op = CMD_OUTPUT;
+            return (cmd->arg >= 0 && (uint32_t)cmd->arg < g_output_count) ? 0 : -1;
+        case NRIO_OP_CLOSE:
+            cmd->op = CMD_CLOSE;
+            return 0;
+        case NRIO_OP_FOCUS:
+            cmd->op = CMD_FOCUS;
+            return (cmd->handle != 0 || cmd->arg == 1 || cmd->arg == -1) ? 0 : -1;
+        case NRIO_OP_LAYOUT:
+            cmd->op = CMD_LAYOUT;
+            return (cmd->arg >= -1 && cmd->arg < LAYOUT_COUNT) ? 0 : -1;
+        case NRIO_OP_WORKSPACE:
+            cmd->op = CMD_WORKSPACE;
+            return (cmd->arg >= 0 && cmd->arg < WORKSPACE_COUNT) ? 0 : -1;
+        case NRIO_OP_RATIO:
+            cmd->op = CMD_RATIO;
+            return (cmd->arg >= 0 && cmd->arg <= 100) ? 0 : -1;
+        case NRIO_OP_HIDE:
+            cmd->op = CMD_HIDE;
+            return 0;
+        case NRIO_OP_SHOW:
+            cmd->op = CMD_SHOW;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/* Validates or applies a binary batch; the size must match the header exactly */
+static int run_binary_commands(const uint8_t* buf, size_t count, uint32_t apply) {
+    const nrio_bin_header_t* hdr = (const nrio_bin_header_t*)buf;
+    if (count < sizeof(*hdr) || hdr->magic != NRIO_BIN_MAGIC) return -1;
+    if (hdr->version != NRIO_BIN_VERSION) return -1;
+    if (count != sizeof(*hdr) + (size_t)hdr->count * sizeof(nrio_bin_record_t)) return -1;
+
+    const nrio_bin_record_t* rec = (const nrio_bin_record_t*)(buf + sizeof(*hdr));
+    for (uint32_t i = 0; i < hdr->count; i++) {
+        wm_command_t cmd;
+        if (decode_binary_command(&rec[i], &cmd) < 0) return -1;
+        if (apply) apply_command(&cmd);
+    }
+    return 0;
+}
+
+static uint32_t is_binary_batch(const uint8_t* buf, size_t count) {
+    return count >= sizeof(uint32_t) &&
+           ((const nrio_bin_header_t*)buf)->magic == NRIO_BIN_MAGIC;
+}
+
+/*
+ * Every write() is one transaction: the whole buffer is validated first, then
+ * applied under a single batch so it produces at most one redraw.
+ */
+static vfs_ssize_t control_write(vfs_file_t* file, const void* buf, size_t count, vfs_off_t* pos) {
+    (void)file;
+    (void)pos;
+
+    if (is_binary_batch(buf, count)) {
+        if (run_binary_commands(buf, count, 0) < 0) return -EINVAL;
+        begin_batch();
+        run_binary_commands(buf, count, 1);
+        end_batch();
+        return (vfs_ssize_t)count;
+    }
+
+    if (run_text_commands(buf, count, 0) < 0) return -EINVAL;
+
+    begin_batch();
+    run_text_commands(buf, count, 1);
+    end_batch();
+    return (vfs_ssize_t)count;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Surface device                                                            */
+/* ------------------------------------------------------------------------- */
+
+static uint32_t rect_area(const rect_t* r) {
+    return r->width * r->height;
+}
+
+static uint32_t rect_overlaps(const rect_t* a, const rect_t* b) {
+    return a->x < b->x + b->width && b->x < a->x + a->width &&
+           a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+static void rect_union(rect_t* dest, const rect_t* a, const rect_t* b) {
+    uint32_t x0 = a->x < b->x ? a->x : b->x;
+    uint32_t y0 = a->y < b->y ? a->y : b->y;
+    uint32_t x1 = a->x + a->width > b->x + b->width ? a->x + a->width : b->x + b->width;
+    uint32_t y1 = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+    dest->x = x0;
+    dest->y = y0;
+    dest->width = x1 - x0;
+    dest->height = y1 - y0;
+}
+
+/*
+ * Adds a surface-space rect to the window's damage. Rects merge when they
+ * overlap or their union costs no more pixels than painting both, so the list
+ * stays disjoint and no pixel is composited twice; once the list is full
+ * everything collapses into one bounding box.
+ */
+static void window_add_damage(window_t* win, uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    const surface_t* s = win->surface;
+    if (!s || x >= s->width || y >= s->height || width == 0 || height == 0) return;
+    if (width > s->width - x) width = s->width - x;
+    if (height > s->height - y) height = s->height - y;
+
+    rect_t r = { x, y, width, height };
+    for (uint32_t i = 0; i < win->damage_count;) {
+        rect_t merged;
+        rect_union(&merged, &win->damage[i], &r);
+        if (rect_overlaps(&win->damage[i], &r) ||
+            rect_area(&merged) <= rect_area(&win->damage[i]) + rect_area(&r)) {
+            r = merged;
+            win->damage[i] = win->damage[--win->damage_count];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (win->damage_count == MAX_DAMAGE_RECTS) {
+        for (uint32_t i = 0; i < win->damage_count; i++) {
+            rect_union(&r, &r, &win->damage[i]);
+        }
+        win->damage_count = 0;
+    }
+    win->damage[win->damage_count++] = r;
+}
+
+/* The selected window, and optionally the workspace it lives on */
+static window_t* surface_target(workspace_t** ws) {
+    uint32_t ws_index, win_index;
+    if (g_surface_target == 0 || !find_window(g_surface_target, &ws_index, &win_index)) return NULL;
+    if (ws) *ws = &g_workspaces[ws_index];
+    return &g_workspaces[ws_index].windows[win_index];
+}
+
+/*
+ * Copies the client's bytes straight into the selected window's surface at the
+ * file position and damages the touched rows. They are presented by the next
+ * commit or redraw, so a run of writes costs one present.
+ */
+static vfs_ssize_t surface_write(vfs_file_t* file, const void* buf, size_t count, vfs_off_t* pos) {
+    (void)file;
+    window_t* win = surface_target(NULL);
+    if (!win || !win->surface) return -ENOENT;
+
+    surface_t* s = win->surface;
+    size_t size = (size_t)s->width * s->height * sizeof(uint32_t);
+    if (*pos < 0 || (size_t)*pos >= size) return -ENOSPC;
+    if (count > size - (size_t)*pos) count = size - (size_t)*pos;
+    if (count == 0) return 0;
+
+    size_t offset = (size_t)*pos;
+    memory_copy((uint8_t*)s->pixels + offset, buf, count);
+    *pos += (vfs_off_t)count;
+
+    uint32_t first = (uint32_t)(offset / sizeof(uint32_t));
+    uint32_t last = (uint32_t)((offset + count - 1) / sizeof(uint32_t));
+    uint32_t row0 = first / s->width;
+    uint32_t row1 = last / s->width;
+    if (row0 == row1) {
+        window_add_damage(win, first % s->width, row0, last - first + 1, 1);
+    } else {
+        window_add_damage(win, 0, row0, s->width, row1 - row0 + 1);
+    }
+    return (vfs_ssize_t)count;
+}
+
+static vfs_off_t surface_seek(vfs_file_t* file, vfs_off_t offset, int whence, vfs_off_t* pos) {
+    (void)file;
+    window_t* win = surface_target(NULL);
+    vfs_off_t size = (win && win->surface)
+        ? (vfs_off_t)win->surface->width * win->surface->height * (vfs_off_t)sizeof(uint32_t) : 0;
+    vfs_off_t base;
+
+    switch (whence) {
+        case VFS_SEEK_SET: base = 0; break;
+        case VFS_SEEK_CUR: base = *pos; break;
+        case VFS_SEEK_END: base = size; break;
+        default: return -EINVAL;
+    }
+    if (base + offset < 0 || base + offset > size) return -EINVAL;
+
+    *pos = base + offset;
+    return *pos;
+}
+
+static int surface_ioctl(vfs_file_t* file, unsigned long request, void* arg) {
+    (void)file;
+    uint32_t ws_index, win_index;
+
+    switch (request) {
+        case NRIO_IOC_SELECT_WINDOW: {
+            uint32_t handle = *(const uint32_t*)arg;
+            if (!find_window(handle, &ws_index, &win_index)) return -ENOENT;
+            g_surface_target = handle;
+            return 0;
+        }
+        case NRIO_IOC_SURFACE_INFO: {
+            nrio_surface_info_t* info = arg;
+            window_t* win = surface_target(NULL);
+            if (!win) return -ENOENT;
+            info->handle = win->handle;
+            info->width = win->surface ? win->surface->width : 0;
+            info->height = win->surface ? win->surface->height : 0;
+            info->pitch = info->width * sizeof(uint32_t);
+            info->bpp = 32;
+            return 0;
+        }
+        case NRIO_IOC_DAMAGE: {
+            const nrio_damage_t* damage = arg;
+            workspace_t* ws;
+            window_t* win = surface_target(&ws);
+            if (!win) return -ENOENT;
+            if (damage->count > NRIO_DAMAGE_MAX_RECTS || (damage->count && !damage->rects)) return -EINVAL;
+
+            for (uint32_t i = 0; i < damage->count; i++) {
+                const nrio_rect_t* r = &damage->rects[i];
+                window_add_damage(win, r->x, r->y, r->width, r->height);
+            }
+            if (damage->flags & NRIO_DAMAGE_COMMIT) {
+                workspace_output(ws)->present_pending = 1;
+                flush_outputs();
+            }
+            return 0;
+        }
+        default:
+            return -ENOTTY;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/* State snapshot device                                                     */
+/* ------------------------------------------------------------------------- */
+
+/* Serializes every workspace, window and computed rect into g_snapshot */
+static uint32_t serialize_state(void) {
+    uint8_t* out = g_snapshot;
+    nrio_state_header_t* hdr = (nrio_state_header_t*)out;
+    window_position_t positions[MAX_WINDOWS_PER_WORKSPACE];
+    out += sizeof(*hdr);
+
+    hdr->magic = NRIO_STATE_MAGIC;
+    hdr->format = NRIO_STATE_FORMAT;
+    hdr->workspace_count = WORKSPACE_COUNT;
+    hdr->state_version = g_state_version;
+    hdr->active_workspace = g_outputs[g_active_output].workspace;
+    hdr->active_output = g_active_output;
+    hdr->output_count = g_output_count;
+
+    for (uint32_t w = 0; w < WORKSPACE_COUNT; w++) {
+        const workspace_t* ws = &g_workspaces[w];
+        const output_t* output = workspace_output(ws);
+        nrio_state_workspace_t* rec = (nrio_state_workspace_t*)out;
+        out += sizeof(*rec);
+
+        uint32_t visible = 0;
+        for (uint32_t i = 0; i < ws->window_count; i++) {
+            if (!ws->windows[i].is_hidden) visible++;
+        }
+        compute_window_positions(output, positions, visible, &ws->layout);
+
+        rec->layout = (uint8_t)ws->layout.type;
+        rec->window_count = (uint8_t)ws->window_count;
+        rec->visible_count = (uint8_t)visible;
+        rec->reserved = 0;
+        rec->focused_handle = workspace_has_visible_focus(ws)
+            ? ws->windows[ws->focused_window_index].handle : 0;
+        rec->master_ratio = ws->layout.master_ratio;
+        rec->output = (uint32_t)(output - g_outputs);
+        rec->output_width = output->width;
+        rec->output_height = output->height;
+
+        uint32_t slot = 0;
+        for (uint32_t i = 0; i < ws->window_count; i++) {
+            const window_t* win = &ws->windows[i];
+            nrio_state_window_t* wrec = (nrio_state_window_t*)out;
+            out += sizeof(*wrec);
+
+            wrec->handle = win->handle;
+            wrec->flags = 0;
+            if (win->is_hidden) wrec->flags |= NRIO_STATE_WIN_HIDDEN;
+            if (wrec->handle == rec->focused_handle) wrec->flags |= NRIO_STATE_WIN_FOCUSED;
+            if (win->is_hidden) {
+                wrec->x = wrec->y = wrec->width = wrec->height = 0;
+            } else {
+                wrec->x = positions[slot].x;
+                wrec->y = positions[slot].y;
+                wrec->width = positions[slot].width;
+                wrec->height = positions[slot].height;
+                slot++;
+            }
+            memory_copy(wrec->title, win->title, NRIO_TITLE_MAX);
+        }
+    }
+
+    hdr->size = (uint32_t)(out - g_snapshot);
+    return hdr->size;
+}
+
+/*
+ * Re-serializes only when the state version moved since the cached snapshot.
+ * Serialization is the seqlock read side: if a batch was in progress or
+ * completed meanwhile (e.g. a hotkey fired mid-read), it starts over.
+ */
+static int refresh_snapshot(void) {
+    for (uint32_t attempt = 0; attempt < SNAPSHOT_MAX_RETRIES; attempt++) {
+        uint32_t seq = __atomic_load_n(&g_state_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+        if (g_snapshot_valid && g_snapshot_version == g_state_version) return 0;
+
+        uint32_t version = g_state_version;
+        uint32_t size = serialize_state();
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&g_state_seq, __ATOMIC_RELAXED) != seq) continue;
+
+        g_snapshot_size = size;
+        g_snapshot_version = version;
+        g_snapshot_valid = 1;
+        return 0;
+    }
+    g_snapshot_valid = 0;
+    return -EBUSY;
+}
+
+/* A read at offset 0 refreshes the snapshot; later offsets continue the cached copy */
+static vfs_ssize_t state_read(vfs_file_t* file, void* buf, size_t count, vfs_off_t* pos) {
+    (void)file;
+    if (*pos < 0) return -EINVAL;
+    if (*pos == 0 || !g_snapshot_valid) {
+        int err = refresh_snapshot();
+        if (err < 0) return err;
+    }
+    if ((size_t)*pos >= g_snapshot_size) return 0;
+
+    size_t n = g_snapshot_size - (size_t)*pos;
+    if (n > count) n = count;
+    memory_copy(buf, g_snapshot + *pos, n);
+    *pos += (vfs_off_t)n;
+    return (vfs_ssize_t)n;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Framebuffer mode changes                                                  */
+/* ------------------------------------------------------------------------- */
+
+/* Reads framebuffer `index` from the kernel; returns 0 if it is unusable */
+static uint32_t framebuffer_read(uint32_t index, struct fb_info* info) {
+    if (API_HAS(fb_count) && API_HAS(fb_get_info)) {
+        return g_api->fb_get_info(index, info) == 0 && info->base && info->width && info->height;
+    }
+
+    /* get_fb_dimensions' pitch has no defined unit, unlike get_fb_pitch_pixels */
+    info->base = g_api->get_framebuffer();
+    g_api->get_fb_dimensions(&info->width, &info->height, &info->pitch);
+    info->format.bpp = 32;
+    info->format.red_mask = 0xFF0000;
+    info->format.green_mask = 0x00FF00;
+    info->format.blue_mask = 0x0000FF;
+    if (API_HAS(get_fb_format) && g_api->get_fb_format(&info->format) < 0) {
+        info->format.bpp = 0;
+    }
+    info->pitch = g_api->get_fb_pitch_pixels() * ((info->format.bpp + 7) / 8);
+    return 1;
+}
+
+/*
+ * Rereads an output's framebuffer. If its address, geometry or format moved,
+ * nothing derived from the old one survives: the incremental redraw state and
+ * the bar cells are dropped so the next redraw repaints it whole, and glyph
+ * and title caches in a format it left are dropped too. An output
+ * the kernel can no longer describe is left without a framebuffer and is not
+ * drawn. Returns 1 if the output changed.
+ */
+static uint32_t output_update(uint32_t index, uint32_t force) {
+    output_t* out = &g_outputs[index];
+    struct fb_info info;
+    if (!framebuffer_read(index, &info)) {
+        info.base = NULL;
+        info.width = info.height = info.pitch = 0;
+        info.format = out->reported;
+    }
+
+    if (!force && info.base == out->framebuffer && info.width == out->width &&
+        info.height == out->height && info.pitch == out->pitch &&
+        fb_format_equal(&info.format, &out->reported)) {
+        return 0;
+    }
+
+    out->framebuffer = info.base;
+    out->width = info.width;
+    out->height = info.height;
+    out->pitch = info.pitch;
+    out->reported = info.format;
+    struct fb_format old_native = out->native;
+    pixel_format_init(out, &info.format);
+    if (!fb_format_equal(&old_native, &out->native)) caches_drop_format(&old_native);
+#ifdef NRIO_OVERDRAW
+    kmem_free(out->overdraw);
+    out->overdraw = kmem_alloc((size_t)out->width * out->height * sizeof(uint16_t));
+#endif
+
+    out->bar_valid = 0;
+    out->prev_window_count = 0;
+    out->prev_focused_handle = 0;
+    out->needs_full_redraw = 1;
+    return 1;
+}
+
+/*
+ * Sets up one output per kernel framebuffer, at most one per workspace. The
+ * count is fixed from here on. Workspaces are split into contiguous runs, one
+ * per output, and each output starts on the first of its run.
+ */
+static void outputs_init(void) {
+    uint32_t count = API_HAS(fb_count) && API_HAS(fb_get_info) ? g_api->fb_count() : 1;
+    if (count == 0) count = 1;
+    if (count > MAX_OUTPUTS) count = MAX_OUTPUTS;
+
+    g_output_count = count;
+    g_active_output = 0;
+    g_output = &g_outputs[0];
+    for (uint32_t o = 0; o < count; o++) {
+        output_t* out = &g_outputs[o];
+        out->first_workspace = o * WORKSPACE_COUNT / count;
+        out->workspace_count = (o + 1) * WORKSPACE_COUNT / count - out->first_workspace;
+        out->workspace = out->first_workspace;
+        out->redraw_pending = 0;
+        out->present_pending = 0;
+        output_update(o, 1);
+    }
+}
+
+/*
+ * Called by the kernel after a mode change on any framebuffer. Only outputs
+ * whose framebuffer changed are reset and repainted; without fb_get_info the
+ * single framebuffer is assumed to have changed. Surfaces are refit by the
+ * full redraw. Glyph and title caches hold ARGB keyed on their own size, so
+ * they stay. The batch makes this one repaint per changed output, even inside
+ * another batch.
+ */
+static void on_fb_change(void* unused) {
+    (void)unused;
+    uint32_t legacy = !(API_HAS(fb_count) && API_HAS(fb_get_info));
+
+    begin_batch();
+    for (uint32_t o = 0; o < g_output_count; o++) {
+        output_t* out = &g_outputs[o];
+        if (!output_update(o, legacy)) continue;
+
+        g_snapshot_valid = 0;
+        event_push(NRIO_EV_MODE, &g_workspaces[out->workspace], 0,
+                   (int32_t)((out->width << 16) | out->height));
+        request_redraw(out);
+    }
+    end_batch();
+}
+
+/* ------------------------------------------------------------------------- */
+/* Keyboard callbacks                                                        */
+/* ------------------------------------------------------------------------- */
 
 static void on_cycle_focus_next(void* unused) {
     (void)unused;
+    begin_batch();
     cycle_focus(1);
+    end_batch();
 }
 
 static void on_cycle_layout(void* unused) {
     (void)unused;
+    begin_batch();
     cycle_layout();
+    end_batch();
 }
 
 static void on_new_window(void* unused) {
     (void)unused;
+    begin_batch();
     add_window_to_current_workspace("template");
+    end_batch();
 }
 
 static void on_close_window(void* unused) {
     (void)unused;
+    begin_batch();
     close_current_window();
+    end_batch();
+}
+
+static void on_hide_window(void* unused) {
+    (void)unused;
+    begin_batch();
+    hide_current_window();
+    end_batch();
+}
+
+static void on_show_window(void* unused) {
+    (void)unused;
+    begin_batch();
+    show_last_hidden_window();
+    end_batch();
+}
+
+static void on_toggle_hud(void* unused) {
+    (void)unused;
+    begin_batch();
+    set_hud(!g_hud_enabled);
+    end_batch();
+}
+
+static void on_cycle_output(void* unused) {
+    (void)unused;
+    begin_batch();
+    cycle_output();
+    end_batch();
 }
 
 /* ------------------------------------------------------------------------- */
 /* Entry point                                                               */
 /* ------------------------------------------------------------------------- */
 
-void _start(struct kernel_api* kernel_api) {
-    g_api = kernel_api;
+/*
+ * Takes the table the kernel passed. Kernels from before api_magic pass a
+ * struct kernel_api_v0; only its first word is read before that is known,
+ * and its members are copied so the rest of the module sees one layout.
+ */
+static struct kernel_api* api_adopt(void* table) {
+    uint64_t magic;
+    memory_copy(&magic, table, sizeof(magic));
+    if (magic == KERNEL_API_MAGIC) return table;
+
+    const struct kernel_api_v0* v0 = table;
+    g_api_v0.api_magic = KERNEL_API_MAGIC;
+    g_api_v0.api_size = __builtin_offsetof(struct kernel_api, get_fb_pitch_pixels) +
+                        sizeof(v0->get_fb_pitch_pixels);
+    g_api_v0.kprint = v0->kprint;
+    g_api_v0.vfs_pseudo_register = v0->vfs_pseudo_register;
+    g_api_v0.kmalloc = v0->kmalloc;
+    g_api_v0.kfree = v0->kfree;
+    g_api_v0.keyboard_register_hotkey = v0->keyboard_register_hotkey;
+    g_api_v0.keyboard_unregister_hotkey = v0->keyboard_unregister_hotkey;
+    g_api_v0.get_framebuffer = v0->get_framebuffer;
+    g_api_v0.get_fb_dimensions = v0->get_fb_dimensions;
+    g_api_v0.get_fb_pitch_pixels = v0->get_fb_pitch_pixels;
+    return &g_api_v0;
+}
 
-    clear_screen();
+void _start(struct kernel_api* kernel_api) {
+    g_api = api_adopt(kernel_api);
 
-    g_framebuffer = g_api->get_framebuffer();
-    g_api->get_fb_dimensions(&g_fb_width, &g_fb_height, &g_fb_pitch_pixels);
-    g_fb_pitch_pixels = g_api->get_fb_pitch_pixels();
+    slab_init(&g_surface_slab, "surface", sizeof(surface_t));
+    arena_init(&g_frame_arena, "frame", g_frame_arena_storage, FRAME_ARENA_SIZE);
+    font_init();
 
     initialize_workspaces();
+    outputs_init();
+    for (uint32_t o = 0; o < g_output_count; o++) {
+        redraw_incremental(&g_outputs[o]);
+    }
 
-    g_prev_window_count = 0;
-    g_prev_layout = LAYOUT_GRID;
-    g_prev_focused = 0;
-
-    redraw_incremental();
+    g_api->vfs_pseudo_register(NRIO_CONTROL_DEVICE, NULL, control_write, NULL, NULL, NULL);
+    g_api->vfs_pseudo_register(NRIO_EVENTS_DEVICE, events_read, NULL, NULL, NULL, NULL);
+    g_api->vfs_pseudo_register(NRIO_STATE_DEVICE, state_read, NULL, NULL, NULL, NULL);
+    g_api->vfs_pseudo_register(NRIO_SURFACE_DEVICE, NULL, surface_write, surface_seek, surface_ioctl, NULL);
+    g_api->vfs_pseudo_register(NRIO_LATENCY_DEVICE, latency_read, NULL, NULL, NULL, NULL);
+    g_api->vfs_pseudo_register(NRIO_MEMORY_DEVICE, memory_read, NULL, NULL, NULL, NULL);
+#ifdef NRIO_TRACE
+    g_api->vfs_pseudo_register(NRIO_TRACE_DEVICE, trace_read, NULL, NULL, NULL, NULL);
+#endif
 
     g_api->keyboard_register_hotkey(0x20, 1, on_cycle_focus_next, NULL);
     g_api->keyboard_register_hotkey(0x26, 1, on_cycle_layout, NULL);
     g_api->keyboard_register_hotkey(0x10, 1, on_close_window, NULL);
     g_api->keyboard_register_hotkey(0x11, 1, on_new_window, NULL);
+    g_api->keyboard_register_hotkey(0x32, 1, on_hide_window, NULL);
+    g_api->keyboard_register_hotkey(0x13, 1, on_show_window, NULL);
+    g_api->keyboard_register_hotkey(0x23, 1, on_toggle_hud, NULL);
+    g_api->keyboard_register_hotkey(0x18, 1, on_cycle_output, NULL);
+
+    if (API_HAS(fb_register_mode_change)) {
+        g_api->fb_register_mode_change(on_fb_change, NULL);
+    }
 }
\ No newline at end of file